@@ -0,0 +1,122 @@
+/*
+Arduino.cpp - Minimal Arduino core shim for building IridiumSBD on a host (Linux/POSIX) machine.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <time.h>
+#include "Arduino.h"
+
+static const int HOST_PIN_COUNT = 64;
+static uint8_t hostPins[HOST_PIN_COUNT];
+static bool hostPinsInitialized = false;
+
+static unsigned long long monotonicMicros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static unsigned long long startMicros = monotonicMicros();
+static unsigned long long skippedMicros = 0;
+
+unsigned long long hostMicros()
+{
+   return monotonicMicros() - startMicros + skippedMicros;
+}
+
+void hostAdvanceClock(unsigned long ms)
+{
+   skippedMicros += 1000ULL * ms;
+}
+
+unsigned long micros()
+{
+   return (unsigned long)hostMicros();
+}
+
+unsigned long millis()
+{
+   return (unsigned long)(hostMicros() / 1000);
+}
+
+void delay(unsigned long ms)
+{
+   struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+   nanosleep(&ts, NULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+   struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000L };
+   nanosleep(&ts, NULL);
+}
+
+// Unconnected inputs read HIGH, which keeps the (active low) RING line idle
+static void initPins()
+{
+   if (!hostPinsInitialized)
+   {
+      memset(hostPins, HIGH, sizeof(hostPins));
+      hostPinsInitialized = true;
+   }
+}
+
+void pinMode(int pin, int mode)
+{
+   (void)pin; (void)mode;
+   initPins();
+}
+
+int digitalRead(int pin)
+{
+   initPins();
+   return pin >= 0 && pin < HOST_PIN_COUNT ? hostPins[pin] : LOW;
+}
+
+void digitalWrite(int pin, int value)
+{
+   hostSetPin(pin, value);
+}
+
+void hostSetPin(int pin, int value)
+{
+   initPins();
+   if (pin >= 0 && pin < HOST_PIN_COUNT)
+      hostPins[pin] = value ? HIGH : LOW;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+   size_t n = 0;
+   while (size--)
+      n += write(*buffer++);
+   return n;
+}
+
+size_t Print::print(long n, int base)
+{
+   if (n < 0 && base == DEC)
+      return print('-') + print((unsigned long)-n, base);
+   return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+   char buf[8 * sizeof(long) + 1];
+   char *p = &buf[sizeof(buf) - 1];
+   *p = '\0';
+   if (base < 2)
+      base = DEC;
+   do
+   {
+      int digit = n % base;
+      *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+      n /= base;
+   } while (n);
+   return write(p);
+}
@@ -0,0 +1,88 @@
+/*
+Arduino.h - Minimal Arduino core shim for building IridiumSBD on a host (Linux/POSIX) machine.
+Only the pieces of the Arduino API that IridiumSBD uses are provided.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef ISBD_HOST_ARDUINO_H
+#define ISBD_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#define ISBD_HOST_BUILD 1
+
+// Program-memory strings are ordinary strings on the host
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+#define PGM_P const char *
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define strlen_P(s) strlen(s)
+#define memcmp_P(a, b, n) memcmp((a), (b), (n))
+
+#define HIGH   1
+#define LOW    0
+#define INPUT  0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(int pin, int mode);
+int digitalRead(int pin);
+void digitalWrite(int pin, int value);
+
+// Host-side pin simulation: lets a test harness drive the RING line, observe the SLEEP line
+void hostSetPin(int pin, int value);
+
+// Host-side clock: micros() without the 32-bit wrap, and a way for a test harness to move
+// millis()/micros() forward as if ms had passed, so minutes of modem time take no time at all
+unsigned long long hostMicros();
+void hostAdvanceClock(unsigned long ms);
+
+class Print
+{
+public:
+   virtual ~Print() {}
+   virtual size_t write(uint8_t c) = 0;
+   virtual size_t write(const uint8_t *buffer, size_t size);
+   size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+   virtual void flush() {}
+
+   size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+   size_t print(const char *str) { return write(str); }
+   size_t print(char c) { return write((uint8_t)c); }
+   size_t print(int n, int base = DEC) { return print((long)n, base); }
+   size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+   size_t print(long n, int base = DEC);
+   size_t print(unsigned long n, int base = DEC);
+
+   size_t println() { return write("\r\n"); }
+   template<typename T> size_t println(T t) { size_t n = print(t); return n + println(); }
+};
+
+class Stream : public Print
+{
+public:
+   virtual int available() = 0;
+   virtual int read() = 0;
+   virtual int peek() = 0;
+};
+
+#endif
@@ -0,0 +1,263 @@
+/*
+AsyncModem - C++20 coroutine adaptor over IridiumSBD's non-blocking session API, with a
+small single-threaded executor.  Many sessions, on any number of modems, can run as
+straight-line code on one thread:
+
+   CoTask report(AsyncModem<IridiumSBD> &modem)
+   {
+      int err = co_await modem.sendReceive(data, size, rx, rxSize);
+      if (err != ISBD_SUCCESS)
+         co_await modem.executor().sleep(60000);
+      ...
+   }
+
+   CoExecutor executor;
+   AsyncModem<IridiumSBD> modem(executor, iridium); // iridium has been through begin()
+   executor.spawn(report(modem));
+   executor.run();
+
+Host builds only (needs <coroutine>).
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef ASYNC_MODEM_H
+#define ASYNC_MODEM_H
+
+#include <coroutine>
+#include <exception>
+#include <vector>
+#include <IridiumSBD.h>
+
+// A coroutine run by CoExecutor.  It starts when spawned and its frame is freed by the
+// executor when it finishes.
+class CoTask
+{
+public:
+   struct promise_type
+   {
+      CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      std::suspend_always final_suspend() noexcept { return {}; }
+      void return_void() { }
+      void unhandled_exception() { std::terminate(); }
+   };
+
+   CoTask(CoTask &&other) : handle(other.handle) { other.handle = nullptr; }
+   ~CoTask() { if (handle) handle.destroy(); }
+
+private:
+   friend class CoExecutor;
+   explicit CoTask(std::coroutine_handle<promise_type> h) : handle(h) { }
+   std::coroutine_handle<promise_type> handle;
+};
+
+class CoExecutor
+{
+public:
+   // Called when no session or timer made progress, with the ms until the next timer
+   // (or a short default); the default just sleeps
+   typedef void (*IdleHook)(void *context, unsigned long ms);
+
+   CoExecutor() : idleHook(nullptr), idleContext(nullptr) { }
+   ~CoExecutor()
+   {
+      for (size_t i=0; i<tasks.size(); ++i)
+         tasks[i].destroy();
+   }
+
+   void spawn(CoTask task)
+   {
+      tasks.push_back(task.handle);
+      ready.push_back(task.handle);
+      task.handle = nullptr;
+   }
+
+   void setIdle(IdleHook hook, void *context = nullptr) { idleHook = hook; idleContext = context; }
+
+   // Run until every spawned task has finished
+   void run()
+   {
+      while (!tasks.empty())
+         step();
+   }
+
+   // Resume what is ready, poll every session in flight, fire due timers; idle if nothing moved
+   void step()
+   {
+      bool progress = !ready.empty();
+      while (!ready.empty())
+      {
+         std::coroutine_handle<> h = ready.front();
+         ready.erase(ready.begin());
+         h.resume();
+      }
+
+      for (size_t i=0; i<sessions.size();)
+      {
+         int ret = sessions[i].poll(sessions[i].modem);
+         if (ret == ISBD_BUSY)
+         {
+            ++i;
+            continue;
+         }
+         *sessions[i].result = ret;
+         ready.push_back(sessions[i].waiter);
+         sessions.erase(sessions.begin() + i);
+         progress = true;
+      }
+
+      unsigned long now = millis();
+      unsigned long next = 1;
+      for (size_t i=0; i<timers.size();)
+      {
+         unsigned long elapsed = now - timers[i].start;
+         if (elapsed >= timers[i].duration)
+         {
+            ready.push_back(timers[i].waiter);
+            timers.erase(timers.begin() + i);
+            progress = true;
+            continue;
+         }
+         if (timers[i].duration - elapsed < next)
+            next = timers[i].duration - elapsed;
+         ++i;
+      }
+
+      reap();
+      if (!progress)
+      {
+         if (idleHook)
+            idleHook(idleContext, next);
+         else
+            delay(next);
+      }
+   }
+
+   // co_await executor.sleep(ms)
+   struct Sleep
+   {
+      CoExecutor &executor;
+      unsigned long ms;
+      bool await_ready() const { return ms == 0; }
+      void await_suspend(std::coroutine_handle<> h) { executor.timers.push_back(Timer { millis(), ms, h }); }
+      void await_resume() { }
+   };
+   Sleep sleep(unsigned long ms) { return Sleep { *this, ms }; }
+
+private:
+   template <class Modem> friend class AsyncModem;
+
+   struct Session
+   {
+      int (*poll)(void *modem);
+      void *modem;
+      int *result;
+      std::coroutine_handle<> waiter;
+   };
+
+   struct Timer
+   {
+      unsigned long start;
+      unsigned long duration;
+      std::coroutine_handle<> waiter;
+   };
+
+   std::vector<std::coroutine_handle<CoTask::promise_type> > tasks;
+   std::vector<std::coroutine_handle<> > ready;
+   std::vector<Session> sessions;
+   std::vector<Timer> timers;
+   IdleHook idleHook;
+   void *idleContext;
+
+   // Free the frames of tasks that have run to completion
+   void reap()
+   {
+      for (size_t i=0; i<tasks.size();)
+      {
+         if (tasks[i].done())
+         {
+            tasks[i].destroy();
+            tasks.erase(tasks.begin() + i);
+         }
+         else
+         {
+            ++i;
+         }
+      }
+   }
+};
+
+// Awaitable sessions on one modem.  Each co_await yields the session's result code.  Only
+// one session per modem may be in flight; a second is refused with ISBD_REENTRANT.
+template <class Modem>
+class AsyncModem
+{
+public:
+   AsyncModem(CoExecutor &executor, Modem &modem) : exec(executor), modem(modem) { }
+
+   CoExecutor &executor() { return exec; }
+   Modem &device() { return modem; }
+
+   class Session
+   {
+   public:
+      bool await_ready() const { return false; }
+      bool await_suspend(std::coroutine_handle<> h)
+      {
+         result = start(owner.modem);
+         if (result != ISBD_SUCCESS)
+            return false; // refused: resume at once with the error
+         owner.exec.sessions.push_back(CoExecutor::Session { pollModem, &owner.modem, &result, h });
+         return true;
+      }
+      int await_resume() const { return result; }
+
+   private:
+      friend class AsyncModem;
+      struct Args
+      {
+         const char *text;
+         const uint8_t *data;
+         size_t size;
+         uint8_t *rx;
+         size_t *rxSize;
+      };
+      Session(AsyncModem &owner, const Args &args) : owner(owner), args(args), result(ISBD_BUSY) { }
+
+      AsyncModem &owner;
+      Args args;
+      int result;
+
+      int start(Modem &m)
+      {
+         if (args.text)
+            return args.rx ? m.startSendReceiveSBDText(args.text, args.rx, *args.rxSize) : m.startSendSBDText(args.text);
+         return args.rx ? m.startSendReceiveSBDBinary(args.data, args.size, args.rx, *args.rxSize)
+            : m.startSendSBDBinary(args.data, args.size);
+      }
+
+      static int pollModem(void *m) { return static_cast<Modem *>(m)->poll(); }
+   };
+
+   // Buffers must stay valid until the co_await completes
+   Session send(const uint8_t *data, size_t size) { return Session(*this, { nullptr, data, size, nullptr, nullptr }); }
+   Session sendText(const char *message) { return Session(*this, { message, nullptr, 0, nullptr, nullptr }); }
+   Session sendReceive(const uint8_t *data, size_t size, uint8_t *rx, size_t &rxSize)
+   {
+      return Session(*this, { nullptr, data, size, rx, &rxSize });
+   }
+   Session sendReceiveText(const char *message, uint8_t *rx, size_t &rxSize)
+   {
+      return Session(*this, { message, nullptr, 0, rx, &rxSize });
+   }
+
+private:
+   CoExecutor &exec;
+   Modem &modem;
+};
+
+#endif
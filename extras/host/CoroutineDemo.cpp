@@ -0,0 +1,81 @@
+/*
+CoroutineDemo - Three simulated modems, each driven by straight-line coroutine code, all
+sharing one thread through CoExecutor.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <time.h>
+#include <IridiumSBD.h>
+#include "AsyncModem.h"
+#include "SimulatedModem.h"
+
+static unsigned long started;
+
+// Send "count" reports, waiting a little and trying again whenever a session fails
+static CoTask reporter(AsyncModem<IridiumSBD> &modem, int id, int count)
+{
+   char message[32];
+   for (int i=0; i<count; ++i)
+   {
+      snprintf(message, sizeof(message), "modem %d report %d", id, i);
+      int err;
+      while ((err = co_await modem.sendText(message)) != ISBD_SUCCESS)
+      {
+         printf("%6lu ms  modem %d: report %d failed (%d), retrying\n", millis() - started, id, i, err);
+         co_await modem.executor().sleep(200);
+      }
+      printf("%6lu ms  modem %d: report %d sent\n", millis() - started, id, i);
+   }
+}
+
+// Ask for commands and act on whatever comes back
+static CoTask commandPoller(AsyncModem<IridiumSBD> &modem, int id)
+{
+   uint8_t rx[64];
+   size_t rxSize = sizeof(rx);
+   int err = co_await modem.sendReceiveText("any commands?", rx, rxSize);
+   printf("%6lu ms  modem %d: mailbox check err=%d, %u-byte command \"%.*s\"\n", millis() - started, id, err,
+      (unsigned)rxSize, (int)rxSize, (const char *)rx);
+}
+
+int main()
+{
+   SimulatedModem sims[3];
+   IridiumSBD modems[3] = { IridiumSBD(sims[0]), IridiumSBD(sims[1]), IridiumSBD(sims[2]) };
+   CoExecutor executor;
+   AsyncModem<IridiumSBD> async[3] = { { executor, modems[0] }, { executor, modems[1] }, { executor, modems[2] } };
+
+   sims[0].setSBDIXLatency(300);
+   sims[1].setSBDIXLatency(700);
+   sims[2].setSBDIXLatency(500);
+   sims[2].queueSBDIXStatus(12); // one fatal failure to retry around
+   const char command[] = "reboot";
+   sims[1].queueMTMessage((const uint8_t *)command, sizeof(command) - 1);
+
+   for (int i=0; i<3; ++i)
+   {
+      if (modems[i].begin() != ISBD_SUCCESS)
+      {
+         printf("begin failed\n");
+         return 1;
+      }
+   }
+
+   executor.spawn(reporter(async[0], 0, 3));
+   executor.spawn(commandPoller(async[1], 1));
+   executor.spawn(reporter(async[2], 2, 2));
+
+   struct timespec ts;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   double cpu = ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+   started = millis();
+   executor.run();
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   cpu = ts.tv_sec * 1e3 + ts.tv_nsec / 1e6 - cpu;
+   printf("all done in %lu ms on one thread, CPU %.0f ms\n", millis() - started, cpu);
+   return 0;
+}
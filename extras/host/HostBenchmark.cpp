@@ -0,0 +1,197 @@
+/*
+HostBenchmark - Measures the host CPU time IridiumSBD spends per message when
+talking to a zero-latency SimulatedModem, first through a port that moves one byte per
+call as a baseline, then with bulk writes; the time per session saved by AT+IPR on a
+paced line; and the aggregate throughput of an ISBDModemPool driving several simulated
+modems at once.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <time.h>
+#include <IridiumSBD.h>
+#include <ISBDModemPool.h>
+#include "SimulatedModem.h"
+
+static double cpuMicros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Baseline: a port with no bulk write, that also hands over its input a byte at a time,
+// as the driver saw every port before payloads were written in chunks
+class PerByteModem : public SimulatedModem
+{
+public:
+   using SimulatedModem::write;
+   size_t write(const uint8_t *buffer, size_t size)
+   {
+      size_t n = 0;
+      while (size--)
+         n += SimulatedModem::write(*buffer++);
+      return n;
+   }
+   int available() { return SimulatedModem::available() > 0 ? 1 : 0; }
+};
+
+// Time "messages" back-to-back 340-byte sends through one flavour of the driver and port
+template <class Modem, class Port>
+static int run(const char *name, int messages)
+{
+   Port sim;
+   Modem modem(sim);
+   uint8_t payload[ISBD_MAX_MESSAGE_LENGTH];
+   for (size_t i=0; i<sizeof(payload); ++i)
+      payload[i] = (uint8_t)(i * 7);
+
+   sim.setResponseLatency(0);
+   sim.setSBDIXLatency(0);
+   if (modem.begin() != ISBD_SUCCESS)
+   {
+      printf("begin failed\n");
+      return 1;
+   }
+
+   // Untimed warm-up, so the first flavour measured doesn't also pay for cold caches
+   for (int i=0; i<10; ++i)
+      modem.sendSBDBinary(payload, sizeof(payload));
+
+   sim.resetStats();
+   double start = cpuMicros();
+   for (int i=0; i<messages; ++i)
+   {
+      int err = modem.sendSBDBinary(payload, sizeof(payload));
+      if (err != ISBD_SUCCESS)
+      {
+         printf("sendSBDBinary failed: error %d\n", err);
+         return 1;
+      }
+   }
+   double elapsed = cpuMicros() - start;
+
+   const SimulatedModem::Stats &s = sim.stats();
+   printf("%s: %d x %u-byte sendSBDBinary\n", name, messages, (unsigned)sizeof(payload));
+   printf("  CPU per message:         %.1f us\n", elapsed / messages);
+   printf("  stream writes/message:   %.1f\n", (double)s.writeCalls / messages);
+   printf("  bytes to modem/message:  %.1f\n", (double)s.bytesFromHost / messages);
+   printf("  bytes from modem/message:%.1f\n", (double)s.bytesToHost / messages);
+   return 0;
+}
+
+static bool followRate(void *context, unsigned long baud)
+{
+   ((SimulatedModem *)context)->setHostBaudRate(baud);
+   return true;
+}
+
+// Time sessions on a paced line at the power-up rate and again after AT+IPR, and report
+// what the faster rate saves per session
+static int runBaudRates(int messages)
+{
+   static const unsigned long rates[2] = { ISBD_DEFAULT_BAUD_RATE, 115200 };
+   double wall[2], line[2];
+   uint8_t payload[ISBD_MAX_MESSAGE_LENGTH];
+   memset(payload, 0x55, sizeof(payload));
+
+   printf("AT+IPR: %u-byte sendSBDBinary on a paced line\n", (unsigned)sizeof(payload));
+   for (int r=0; r<2; ++r)
+   {
+      SimulatedModem sim;
+      IridiumSBD modem(sim);
+      sim.setBaudRate(ISBD_DEFAULT_BAUD_RATE);
+      sim.setResponseLatency(0);
+      sim.setSBDIXLatency(0);
+      if (modem.begin() != ISBD_SUCCESS || modem.negotiateBaudRate(rates[r], followRate, &sim) != ISBD_SUCCESS)
+      {
+         printf("begin or negotiateBaudRate failed\n");
+         return 1;
+      }
+
+      sim.resetStats();
+      unsigned long start = millis();
+      for (int i=0; i<messages; ++i)
+         if (modem.sendSBDBinary(payload, sizeof(payload)) != ISBD_SUCCESS)
+         {
+            printf("sendSBDBinary failed\n");
+            return 1;
+         }
+
+      // The simulator paces only what the modem sends; count both directions for the line
+      const SimulatedModem::Stats &st = sim.stats();
+      wall[r] = (double)(millis() - start) / messages;
+      line[r] = (st.bytesFromHost + st.bytesToHost) * 10000.0 / rates[r] / messages;
+      printf("  %6lu baud: %5.1f ms per session, %5.1f ms of line time both ways\n", rates[r], wall[r], line[r]);
+   }
+   printf("  saved per session: %.1f ms measured, %.1f ms of line time\n", wall[0] - wall[1], line[0] - line[1]);
+   return 0;
+}
+
+static void countResult(void *context, void *tag, int result)
+{
+   (void)tag;
+   if (result == ISBD_SUCCESS)
+      ++*(unsigned long *)context;
+}
+
+// Keep a pool of "count" simulated modems busy for "seconds" and report messages per hour
+static int runPool(int count, int seconds)
+{
+   const unsigned long sbdixLatency = 500;
+   SimulatedModem sims[4];
+   IridiumSBD *modems[4];
+   unsigned long delivered = 0;
+   ISBDModemPool<IridiumSBD, 4, 8> pool(countResult, &delivered);
+   static uint8_t payload[ISBD_MAX_MESSAGE_LENGTH];
+
+   for (int i=0; i<count; ++i)
+   {
+      sims[i].setSBDIXLatency(sbdixLatency);
+      modems[i] = new IridiumSBD(sims[i]);
+      if (modems[i]->begin() != ISBD_SUCCESS)
+      {
+         printf("begin failed\n");
+         return 1;
+      }
+      pool.addModem(*modems[i]);
+   }
+
+   double start = cpuMicros();
+   unsigned long t0 = millis();
+   while (millis() - t0 < 1000UL * seconds)
+   {
+      while (pool.submit(payload, sizeof(payload)))
+         ;
+      pool.poll();
+   }
+   double elapsed = millis() - t0;
+   double cpu = cpuMicros() - start;
+
+   printf("  %d modem%s: %lu messages in %.1f s = %.0f messages/hour (CPU %.0f%%)\n", count, count == 1 ? " " : "s",
+      delivered, elapsed / 1000, delivered * 3600000.0 / elapsed, cpu / elapsed / 10);
+   for (int i=0; i<count; ++i)
+      delete modems[i];
+   return 0;
+}
+
+int main(int argc, char *argv[])
+{
+   int messages = argc > 1 ? atoi(argv[1]) : 200;
+   if (run<IridiumSBD, PerByteModem>("IridiumSBD, per-byte port (baseline)", messages)
+      || run<IridiumSBD, SimulatedModem>("IridiumSBD", messages)
+      || run<BasicIridiumSBD<SimulatedModem, ISBDMinimalPolicy>, SimulatedModem>("BasicIridiumSBD<SimulatedModem, ISBDMinimalPolicy>", messages))
+      return 1;
+
+   if (runBaudRates(20))
+      return 1;
+
+   printf("ISBDModemPool: 340-byte messages, 500 ms +SBDIX\n");
+   for (int count=1; count<=4; count*=2)
+      if (runPool(count, 3))
+         return 1;
+   return 0;
+}
@@ -0,0 +1,107 @@
+/*
+HostDemo - Runs IridiumSBD on the host against SimulatedModem and reports
+how long each operation took and how much traffic it generated.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <time.h>
+#include <IridiumSBD.h>
+#include "SimulatedModem.h"
+
+static SimulatedModem sim;
+static IridiumSBD modem(sim);
+
+static void report(const char *what, int err, unsigned long start)
+{
+   const SimulatedModem::Stats &s = sim.stats();
+   printf("%-22s err=%-2d %6lu ms  commands=%-3lu tx=%-4lu rx=%-4lu writes=%lu\n",
+      what, err, millis() - start, s.commands, s.bytesFromHost, s.bytesToHost, s.writeCalls);
+   sim.resetStats();
+}
+
+// Stands in for the client reopening its serial port at a new rate
+static bool setHostBaudRate(void *context, unsigned long baud)
+{
+   (void)context;
+   sim.setHostBaudRate(baud);
+   return true;
+}
+
+// A full-size send/receive, returning how long it took
+static unsigned long fullSizeSession(const char *what)
+{
+   static uint8_t payload[ISBD_MAX_MESSAGE_LENGTH];
+   static uint8_t mt[270];
+   uint8_t rx[270];
+   size_t rxSize = sizeof(rx);
+
+   sim.queueMTMessage(mt, sizeof(mt));
+   unsigned long start = millis();
+   int err = modem.sendReceiveSBDBinary(payload, sizeof(payload), rx, rxSize);
+   unsigned long elapsed = millis() - start;
+   report(what, err, start);
+   return elapsed;
+}
+
+int main()
+{
+   static const uint8_t mtMessage[] = "Hello from the sky";
+   uint8_t message[64] = { 1, 1, 2, 3, 5, 8, 13, 21, 34, 55, 89 };
+   uint8_t rx[270];
+   size_t rxSize;
+   unsigned long start;
+   int err;
+
+   start = millis();
+   err = modem.begin();
+   report("begin", err, start);
+
+   int quality = -1;
+   start = millis();
+   err = modem.getSignalQuality(quality);
+   report("getSignalQuality", err, start);
+
+   struct tm t;
+   start = millis();
+   err = modem.getSystemTime(t);
+   report("getSystemTime", err, start);
+
+   sim.queueMTMessage(mtMessage, sizeof(mtMessage) - 1);
+   rxSize = sizeof(rx);
+   start = millis();
+   err = modem.sendReceiveSBDBinary(message, 11, rx, rxSize);
+   report("sendReceiveSBDBinary", err, start);
+   printf("  received %u bytes: %.*s\n", (unsigned)rxSize, (int)rxSize, (const char *)rx);
+
+   // Same transfer driven through the non-blocking API
+   rxSize = sizeof(rx);
+   unsigned long polls = 0;
+   start = millis();
+   err = modem.startSendReceiveSBDBinary(message, sizeof(message), rx, rxSize);
+   if (err == ISBD_SUCCESS)
+      while ((err = modem.poll()) == ISBD_BUSY)
+         ++polls;
+   report("startSendReceive/poll", err, start);
+   printf("  %lu polls\n", polls);
+
+   start = millis();
+   err = modem.sendSBDText("Hello, world!");
+   report("sendSBDText", err, start);
+
+   // 340 bytes out and 270 in, first at the default rate and then after switching to 115200
+   sim.setBaudRate(ISBD_DEFAULT_BAUD_RATE);
+   unsigned long slow = fullSizeSession("session at 19200");
+
+   start = millis();
+   err = modem.negotiateBaudRate(115200, setHostBaudRate);
+   report("negotiateBaudRate", err, start);
+
+   unsigned long fast = fullSizeSession("session at 115200");
+   printf("  %ld ms saved per session\n", (long)slow - (long)fast);
+
+   return 0;
+}
@@ -0,0 +1,1257 @@
+/*
+HostTest - Regression tests for IridiumSBD, run against SimulatedModem with its failure
+injection.  "make test" builds and runs them; the exit status is non-zero if any check
+fails.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <IridiumSBD.h>
+#include <ISBDModemPool.h>
+#include "SimulatedModem.h"
+#include <string.h>
+#include <time.h>
+
+static int failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+#define CHECK_EQUAL(actual, expected) checkEqual((long)(actual), (long)(expected), #actual, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+   if (!ok)
+   {
+      printf("    line %d: CHECK(%s) failed\n", line, what);
+      ++failures;
+   }
+}
+
+static void checkEqual(long actual, long expected, const char *what, int line)
+{
+   if (actual != expected)
+   {
+      printf("    line %d: %s is %ld, expected %ld\n", line, what, actual, expected);
+      ++failures;
+   }
+}
+
+// A modem that has been through begin()
+struct Fixture
+{
+   SimulatedModem sim;
+   IridiumSBD modem;
+
+   Fixture() : modem(sim) { }
+   bool begin() { return modem.begin() == ISBD_SUCCESS; }
+};
+
+static void testSendReceive()
+{
+   Fixture f;
+   CHECK(f.begin());
+
+   static const uint8_t mt[] = "downlink";
+   f.sim.queueMTMessage(mt, sizeof(mt) - 1);
+   uint8_t mo[] = { 0x00, 0x0D, 0x0A, 0xFF }, rx[64];
+   size_t rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDBinary(mo, sizeof(mo), rx, rxSize), ISBD_SUCCESS);
+   CHECK_EQUAL(rxSize, sizeof(mt) - 1);
+   CHECK(memcmp(rx, mt, sizeof(mt) - 1) == 0);
+   CHECK_EQUAL(f.sim.sentMessages().size(), 1);
+   CHECK(f.sim.sentMessages()[0] == std::vector<uint8_t>(mo, mo + sizeof(mo)));
+}
+
+static void testNoNetwork()
+{
+   Fixture f;
+   CHECK(f.begin());
+   f.sim.setNetworkAvailable(false);
+   struct tm t;
+   CHECK_EQUAL(f.modem.getSystemTime(t), ISBD_NO_NETWORK);
+   f.sim.setNetworkAvailable(true);
+   CHECK_EQUAL(f.modem.getSystemTime(t), ISBD_SUCCESS);
+}
+
+static void testSBDIXFatal()
+{
+   Fixture f;
+   CHECK(f.begin());
+   f.sim.queueSBDIXStatus(12);
+   CHECK_EQUAL(f.modem.sendSBDText("fatal"), ISBD_SBDIX_FATAL_ERROR);
+   CHECK_EQUAL(f.sim.stats().sbdixAttempts, 1);
+   CHECK_EQUAL(f.modem.sendSBDText("again"), ISBD_SUCCESS);
+}
+
+static void testFailedCommand()
+{
+   Fixture f;
+   CHECK(f.begin());
+   f.sim.failCommand("AT+CSQ");
+   int quality;
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_PROTOCOL_ERROR);
+   f.sim.clearFailures();
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS);
+}
+
+static void testRing()
+{
+   Fixture f;
+   f.modem.enableRingAlerts(true);
+   CHECK(f.begin());
+   CHECK(!f.modem.hasRingAsserted());
+   f.sim.ring();
+   delay(50);
+   CHECK(f.modem.hasRingAsserted());
+   CHECK(!f.modem.hasRingAsserted()); // reported once
+}
+
+static void appendChar(void *context, char c)
+{
+   *(std::string *)context += c;
+}
+
+// Unsolicited codes arriving between the lines of a solicited response are taken out of it,
+// and lines that only start like one ("+CIER:", "+CSQ:") are passed through whole
+static void testURCMidResponse()
+{
+   Fixture f;
+   f.modem.enableRingAlerts(true);
+   CHECK(f.begin());
+   std::string diags;
+   f.modem.setDiagsOutput(appendChar, &diags);
+
+   f.sim.scriptResponse("AT+CSQ", "\r\n+CIEV:0,3\r\n+CIER:1,0,0,0\r\n+CSQ:4\r\n+AREG:1,1\r\nSBDRING\r\n+CIEV:1,0\r\n\r\nOK\r\n");
+   int quality = -1;
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS);
+   CHECK_EQUAL(quality, 4);
+   CHECK_EQUAL(f.modem.getSignalIndication(), 3);
+   CHECK(f.modem.hasRingAsserted());
+   CHECK(diags.find("+AREG:1,1\r\n") != std::string::npos);
+   CHECK(diags.find("+CIEV:1,0\r\n") != std::string::npos);
+
+   // A held "+C" that turns into a response line must not lose characters
+   f.sim.scriptResponse("AT+CSQ", "\r\n+CIEV:0,2\r\n+CSQ:1\r\n\r\nOK\r\n");
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS);
+   CHECK_EQUAL(quality, 1);
+   CHECK_EQUAL(f.modem.getSignalIndication(), 2);
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS); // the simulator's own answer
+   CHECK_EQUAL(quality, 4);
+}
+
+static void testFinalResultMidLine()
+{
+   // "ERROR\r\n" ends a line of the +CGMR response without being a final result
+   Fixture f;
+   f.sim.setFirmwareVersion("TA1ERROR");
+   CHECK(f.begin());
+   char version[16];
+   CHECK_EQUAL(f.modem.getFirmwareVersion(version, sizeof(version)), ISBD_SUCCESS);
+   CHECK(strcmp(version, "TA1ERROR") == 0);
+}
+
+// ERROR, and a failing +SBDWB result code, end the command at once instead of leaving it
+// to run into atTimeout
+static void testErrorFailsFast()
+{
+   Fixture f;
+   CHECK(f.begin());
+   uint8_t mo[8] = { 0 };
+
+   f.sim.failCommand("AT+SBDWB");
+   unsigned long start = millis();
+   CHECK_EQUAL(f.modem.sendSBDBinary(mo, sizeof(mo)), ISBD_PROTOCOL_ERROR);
+   CHECK(millis() - start < 1000);
+   f.sim.clearFailures();
+
+   f.sim.setSBDWBResult(2); // checksum mismatch
+   start = millis();
+   CHECK_EQUAL(f.modem.sendSBDBinary(mo, sizeof(mo)), ISBD_PROTOCOL_ERROR);
+   CHECK(millis() - start < 1000);
+   f.sim.clearFailures();
+
+   CHECK_EQUAL(f.modem.sendSBDBinary(mo, sizeof(mo)), ISBD_SUCCESS);
+   CHECK_EQUAL(f.sim.stats().sbdixAttempts, 1);
+}
+
+static void appendTo(void *context, const uint8_t *data, size_t size)
+{
+   std::vector<uint8_t> *v = (std::vector<uint8_t> *)context;
+   v->insert(v->end(), data, data + size);
+}
+
+// The +SBDRB checksum is verified, whether the message goes to a buffer or a sink
+static void testMTChecksum()
+{
+   Fixture f;
+   CHECK(f.begin());
+   uint8_t mt[200], rx[270];
+   for (size_t i=0; i<sizeof(mt); ++i)
+      mt[i] = (uint8_t)(i * 13);
+
+   f.sim.queueMTMessage(mt, sizeof(mt));
+   std::vector<uint8_t> streamed;
+   CHECK_EQUAL(f.modem.sendReceiveSBDText("sink", appendTo, &streamed), ISBD_SUCCESS);
+   CHECK(streamed == std::vector<uint8_t>(mt, mt + sizeof(mt)));
+
+   f.sim.corruptMTChecksum(true);
+   f.sim.queueMTMessage(mt, sizeof(mt));
+   size_t rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText("buffer", rx, rxSize), ISBD_CHECKSUM_ERROR);
+   f.sim.queueMTMessage(mt, sizeof(mt));
+   streamed.clear();
+   CHECK_EQUAL(f.modem.sendReceiveSBDText("sink", appendTo, &streamed), ISBD_CHECKSUM_ERROR);
+}
+
+struct Mailbox
+{
+   std::vector<uint16_t> msns;
+   std::vector<std::string> messages;
+};
+
+static void collect(void *context, uint16_t mtMSN, const uint8_t *data, size_t size)
+{
+   Mailbox *box = (Mailbox *)context;
+   box->msns.push_back(mtMSN);
+   box->messages.push_back(std::string((const char *)data, size));
+}
+
+// drainMailbox() fetches queued MT messages back to back, one +SBDIX/+SBDRB pair each
+static void testDrainMailbox()
+{
+   Fixture f;
+   CHECK(f.begin());
+   const char *queued[] = { "one", "two", "three" };
+   for (int i=0; i<3; ++i)
+      f.sim.queueMTMessage((const uint8_t *)queued[i], strlen(queued[i]));
+
+   uint8_t rx[64];
+   Mailbox box;
+   f.sim.resetStats();
+   CHECK_EQUAL(f.modem.drainMailbox(rx, sizeof(rx), collect, &box, 2), ISBD_SUCCESS);
+   CHECK_EQUAL(box.messages.size(), 2);
+   CHECK_EQUAL(f.modem.getWaitingMessageCount(), 1);
+
+   CHECK_EQUAL(f.modem.drainMailbox(rx, sizeof(rx), collect, &box), ISBD_SUCCESS);
+   CHECK_EQUAL(box.messages.size(), 3);
+   for (size_t i=0; i<box.messages.size(); ++i)
+   {
+      CHECK(box.messages[i] == queued[i]);
+      CHECK_EQUAL(box.msns[i], i + 1);
+   }
+   CHECK_EQUAL(f.modem.getWaitingMessageCount(), 0);
+   CHECK_EQUAL(f.sim.stats().sbdixAttempts, 3);
+   for (size_t i=0; i<f.sim.sentMessages().size(); ++i)
+      CHECK(f.sim.sentMessages()[i].empty()); // the MO buffer was cleared, not resent
+}
+
+// With fast wake, begin() after sleep() relies on the modem's stored profile and the
+// cached firmware check, so it sends fewer commands
+static void testFastWake()
+{
+   const int sleepPin = 7;
+   SimulatedModem sim;
+   IridiumSBD modem(sim, sleepPin);
+   modem.useFastWake(true);
+   sim.resetStats();
+   CHECK_EQUAL(modem.begin(), ISBD_SUCCESS);
+   unsigned long coldCommands = sim.stats().commands;
+   unsigned long coldLatency = modem.getWakeLatency();
+
+   CHECK_EQUAL(modem.sleep(), ISBD_SUCCESS);
+   CHECK(modem.isAsleep());
+   sim.powerCycle();
+   sim.resetStats();
+   CHECK_EQUAL(modem.begin(), ISBD_SUCCESS);
+   CHECK(sim.stats().commands < coldCommands);
+   CHECK(modem.getWakeLatency() > 0);
+   CHECK(modem.getWakeLatency() <= coldLatency);
+
+   // The restored profile must leave the modem fully usable
+   CHECK_EQUAL(modem.sendSBDText("awake"), ISBD_SUCCESS);
+}
+
+// The same exchange with echo off parses correctly and brings back fewer bytes
+static void testEchoOff()
+{
+   static const uint8_t mt[] = "echo off";
+   uint8_t mo[100], rx[64];
+   memset(mo, 0x5A, sizeof(mo));
+   unsigned long received[2];
+
+   for (int echo=0; echo<2; ++echo)
+   {
+      Fixture f;
+      f.modem.useCommandEcho(echo != 0);
+      CHECK(f.begin());
+      f.sim.queueMTMessage(mt, sizeof(mt) - 1);
+      f.sim.resetStats();
+      size_t rxSize = sizeof(rx);
+      CHECK_EQUAL(f.modem.sendReceiveSBDBinary(mo, sizeof(mo), rx, rxSize), ISBD_SUCCESS);
+      CHECK_EQUAL(rxSize, sizeof(mt) - 1);
+      CHECK(memcmp(rx, mt, sizeof(mt) - 1) == 0);
+      CHECK(f.sim.sentMessages().size() == 1 && f.sim.sentMessages()[0] == std::vector<uint8_t>(mo, mo + sizeof(mo)));
+      received[echo] = f.sim.stats().bytesToHost;
+   }
+   CHECK(received[0] < received[1]);
+}
+
+static std::string sentText(const SimulatedModem &sim, size_t i)
+{
+   const std::vector<uint8_t> &m = sim.sentMessages()[i];
+   return std::string(m.begin(), m.end());
+}
+
+// Highest priority first, then oldest; a full arena makes room by dropping the oldest
+// lower-priority message; a failed session keeps the message
+static void testOutbox()
+{
+   uint8_t arena[3 * (11 + 8)];
+   ISBDOutbox outbox(arena, sizeof(arena));
+   CHECK_EQUAL(outbox.add((const uint8_t *)"routine1", 8), ISBD_SUCCESS);
+   CHECK_EQUAL(outbox.add((const uint8_t *)"routine2", 8), ISBD_SUCCESS);
+   CHECK_EQUAL(outbox.add((const uint8_t *)"routine3", 8), ISBD_SUCCESS);
+   CHECK_EQUAL(outbox.add((const uint8_t *)"routine4", 8), ISBD_QUEUE_FULL);
+   CHECK_EQUAL(outbox.add((const uint8_t *)"alarm!!!", 8, ISBD_PRIORITY_ALARM), ISBD_SUCCESS);
+   CHECK_EQUAL(outbox.count(), 3);
+   CHECK_EQUAL(outbox.dropped(), 1);
+
+   Fixture f;
+   CHECK(f.begin());
+   f.modem.setOutbox(&outbox);
+   f.sim.queueSBDIXStatus(12);
+   CHECK_EQUAL(f.modem.sendQueued(), ISBD_SBDIX_FATAL_ERROR);
+   CHECK_EQUAL(outbox.count(), 3);
+
+   CHECK_EQUAL(f.modem.sendQueued(), ISBD_SUCCESS);
+   CHECK_EQUAL(outbox.count(), 0);
+   CHECK_EQUAL(f.sim.sentMessages().size(), 3);
+   CHECK(sentText(f.sim, 0) == "alarm!!!");
+   CHECK(sentText(f.sim, 1) == "routine2");
+   CHECK(sentText(f.sim, 2) == "routine3");
+   CHECK_EQUAL(f.modem.startSendQueued(), ISBD_QUEUE_EMPTY);
+}
+
+// While a message is being sent it stays where it is, but those behind it can still expire
+// or make way for an alarm; an empty message is refused
+static void testOutboxClaimed()
+{
+   uint8_t arena[3 * (11 + 8)];
+   ISBDOutbox outbox(arena, sizeof(arena));
+   CHECK_EQUAL(outbox.add((const uint8_t *)"", 0), ISBD_MSG_EMPTY);
+   CHECK_EQUAL(outbox.count(), 0);
+
+   CHECK_EQUAL(outbox.add((const uint8_t *)"routineA", 8, ISBD_PRIORITY_ROUTINE, 10), ISBD_SUCCESS);
+   ISBDSegment claimed;
+   CHECK(outbox.next(claimed));
+   CHECK_EQUAL(outbox.add((const uint8_t *)"routineB", 8), ISBD_SUCCESS);
+   CHECK_EQUAL(outbox.add((const uint8_t *)"routineC", 8, ISBD_PRIORITY_ROUTINE, 1), ISBD_SUCCESS);
+   CHECK_EQUAL(outbox.add((const uint8_t *)"alarm!!D", 8, ISBD_PRIORITY_ALARM), ISBD_SUCCESS);
+   CHECK_EQUAL(outbox.dropped(), 1); // B
+
+   hostAdvanceClock(11000); // A and C expire; A is being sent, so only C goes
+   CHECK_EQUAL(outbox.add((const uint8_t *)"routineE", 8), ISBD_SUCCESS);
+   CHECK_EQUAL(outbox.count(), 3);
+   CHECK_EQUAL(outbox.dropped(), 2);
+   CHECK(claimed.data == arena + 11 && memcmp(claimed.data, "routineA", 8) == 0);
+
+   outbox.complete(true);
+   CHECK_EQUAL(outbox.count(), 2);
+   CHECK(outbox.next(claimed));
+   CHECK(memcmp(claimed.data, "alarm!!D", 8) == 0);
+   outbox.complete(true);
+   CHECK(outbox.next(claimed));
+   CHECK(memcmp(claimed.data, "routineE", 8) == 0);
+}
+
+// RAM standing in for flash: writes can only clear bits, and can be made to fail part way
+struct Flash
+{
+   uint8_t bytes[4 * 128];
+   int writesLeft; // -1 for no limit
+};
+
+static bool flashRead(void *context, uint32_t address, uint8_t *data, size_t size)
+{
+   memcpy(data, ((Flash *)context)->bytes + address, size);
+   return true;
+}
+
+static bool flashWrite(void *context, uint32_t address, const uint8_t *data, size_t size)
+{
+   Flash *flash = (Flash *)context;
+   if (flash->writesLeft == 0)
+      return false;
+   if (flash->writesLeft > 0)
+      --flash->writesLeft;
+   for (size_t i=0; i<size; ++i)
+      flash->bytes[address + i] &= data[i];
+   return true;
+}
+
+static bool flashErase(void *context, uint16_t page)
+{
+   memset(((Flash *)context)->bytes + page * 128, 0xFF, 128);
+   return true;
+}
+
+// Nothing is accepted before begin(); an append cut short by a reset is skipped after
+// reopening, and the messages around it are still sent in order
+static void testJournal()
+{
+   Flash flash;
+   memset(flash.bytes, 0xFF, sizeof(flash.bytes));
+   flash.writesLeft = -1;
+   ISBDStorage storage = { 128, 4, flashRead, flashWrite, flashErase, NULL, &flash };
+
+   {
+      ISBDJournal journal(storage);
+      ISBDSegment message;
+      CHECK_EQUAL(journal.add((const uint8_t *)"early", 5), ISBD_STORAGE_ERROR);
+      CHECK(!journal.next(message));
+      CHECK_EQUAL(journal.begin(), ISBD_SUCCESS);
+      CHECK_EQUAL(journal.add((const uint8_t *)"", 0), ISBD_MSG_EMPTY);
+      CHECK_EQUAL(journal.add((const uint8_t *)"before", 6), ISBD_SUCCESS);
+      flash.writesLeft = 2; // header written, payload not
+      CHECK_EQUAL(journal.add((const uint8_t *)"torn", 4), ISBD_STORAGE_ERROR);
+      flash.writesLeft = -1;
+      CHECK_EQUAL(journal.add((const uint8_t *)"after", 5), ISBD_SUCCESS);
+      CHECK_EQUAL(journal.count(), 2);
+   }
+
+   ISBDJournal journal(storage);
+   CHECK_EQUAL(journal.begin(), ISBD_SUCCESS);
+   CHECK_EQUAL(journal.count(), 2);
+
+   Fixture f;
+   CHECK(f.begin());
+   f.modem.setOutbox(&journal);
+   CHECK_EQUAL(f.modem.sendQueued(), ISBD_SUCCESS);
+   CHECK_EQUAL(journal.count(), 0);
+   CHECK_EQUAL(f.sim.sentMessages().size(), 2);
+   CHECK(sentText(f.sim, 0) == "before");
+   CHECK(sentText(f.sim, 1) == "after");
+}
+
+// A repeated MTMSN is left unread, whether the history is in RAM or reloaded from storage;
+// with manual recording the message is delivered again until the client records it
+static void testMTHistory()
+{
+   Fixture f;
+   CHECK(f.begin());
+   ISBDMTHistory memory;
+   CHECK_EQUAL(memory.begin(), ISBD_SUCCESS);
+   f.modem.setMTHistory(&memory);
+
+   uint8_t rx[64];
+   size_t rxSize = sizeof(rx);
+   f.sim.queueMTMessage((const uint8_t *)"first", 5);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText(NULL, rx, rxSize), ISBD_SUCCESS);
+   CHECK_EQUAL(rxSize, 5);
+   f.sim.repeatMTMessage();
+   rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText(NULL, rx, rxSize), ISBD_SUCCESS);
+   CHECK_EQUAL(rxSize, 0);
+
+   // Persistent history survives being reloaded
+   Flash flash;
+   memset(flash.bytes, 0xFF, sizeof(flash.bytes));
+   flash.writesLeft = -1;
+   ISBDStorage storage = { 128, 4, flashRead, flashWrite, flashErase, NULL, &flash };
+   {
+      ISBDMTHistory saved(storage);
+      CHECK_EQUAL(saved.begin(), ISBD_SUCCESS);
+      f.modem.setMTHistory(&saved);
+      f.sim.queueMTMessage((const uint8_t *)"second", 6);
+      rxSize = sizeof(rx);
+      CHECK_EQUAL(f.modem.sendReceiveSBDText(NULL, rx, rxSize), ISBD_SUCCESS);
+      CHECK_EQUAL(rxSize, 6);
+   }
+   ISBDMTHistory reloaded(storage);
+   CHECK_EQUAL(reloaded.begin(), ISBD_SUCCESS);
+   f.modem.setMTHistory(&reloaded);
+   f.sim.repeatMTMessage();
+   rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText(NULL, rx, rxSize), ISBD_SUCCESS);
+   CHECK_EQUAL(rxSize, 0);
+
+   // drainMailbox() passes over the repeat and goes on to the next message
+   Mailbox box;
+   f.sim.repeatMTMessage();
+   f.sim.queueMTMessage((const uint8_t *)"third", 5);
+   CHECK_EQUAL(f.modem.drainMailbox(rx, sizeof(rx), collect, &box), ISBD_SUCCESS);
+   CHECK_EQUAL(box.messages.size(), 1);
+   CHECK(box.messages.size() == 1 && box.messages[0] == "third");
+
+   // Manual recording
+   f.modem.setMTHistory(&reloaded, false);
+   f.sim.queueMTMessage((const uint8_t *)"fourth", 6);
+   rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText(NULL, rx, rxSize), ISBD_SUCCESS);
+   f.sim.repeatMTMessage();
+   rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText(NULL, rx, rxSize), ISBD_SUCCESS);
+   CHECK_EQUAL(rxSize, 6);
+   CHECK_EQUAL(reloaded.record((uint16_t)f.modem.getMTMSN()), ISBD_SUCCESS);
+   f.sim.repeatMTMessage();
+   rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText(NULL, rx, rxSize), ISBD_SUCCESS);
+   CHECK_EQUAL(rxSize, 0);
+}
+
+// Stands in for a modem in ISBDModemPool: refuses to start, or finishes each session on
+// the first poll()
+struct PoolModem
+{
+   int startResult;
+   int sessionResult;
+   int bars;    // +CIEV
+   int quality; // +CSQ
+   bool sending;
+   int starts;
+
+   PoolModem(int startResult, int bars, int quality = -1) :
+      startResult(startResult), sessionResult(ISBD_SUCCESS), bars(bars), quality(quality), sending(false), starts(0) { }
+   int startSendSBDBinary(const uint8_t *, size_t) { ++starts; sending = startResult == ISBD_SUCCESS; return startResult; }
+   int poll() { sending = false; return sessionResult; }
+   bool isAsleep() { return false; }
+   bool isBusy() { return sending; }
+   int getSignalIndication() { return bars; }
+   int getLastSignalQuality() { return quality; }
+};
+
+static void poolResult(void *context, void *tag, int result)
+{
+   (void)tag;
+   *(int *)context = result;
+}
+
+// A modem that turns a job down doesn't use up its tries; it goes to the next best modem
+static void testPoolRefusal()
+{
+   PoolModem refusing(ISBD_REENTRANT, 5), willing(ISBD_SUCCESS, 1);
+   int result = -1;
+   ISBDModemPool<PoolModem, 2, 4> pool(poolResult, &result);
+   pool.addModem(refusing);
+   pool.addModem(willing);
+   CHECK(pool.submit((const uint8_t *)"job", 3));
+
+   pool.poll();
+   CHECK_EQUAL(refusing.starts, 1);
+   CHECK_EQUAL(willing.starts, 1);
+   pool.poll();
+   CHECK_EQUAL(result, ISBD_SUCCESS);
+   CHECK_EQUAL(pool.pending(), 0);
+   CHECK_EQUAL(pool.successRate(0), 128);
+}
+
+// Without +CIEV a modem is scored on its last +CSQ reading
+static void testPoolSignal()
+{
+   PoolModem weak(ISBD_SUCCESS, -1, 1), strong(ISBD_SUCCESS, -1, 4), unknown(ISBD_SUCCESS, -1);
+   ISBDModemPool<PoolModem, 3, 4> pool;
+   pool.addModem(weak);
+   pool.addModem(unknown);
+   pool.addModem(strong);
+   CHECK(pool.submit((const uint8_t *)"job", 3));
+   pool.poll();
+   CHECK_EQUAL(strong.starts, 1);
+   CHECK_EQUAL(weak.starts + unknown.starts, 0);
+
+   // +CIEV, when there is one, outranks an older +CSQ
+   weak.bars = 5;
+   strong.bars = 0;
+   CHECK(pool.submit((const uint8_t *)"job", 3));
+   pool.poll();
+   CHECK_EQUAL(weak.starts, 1);
+}
+
+// A failed message waits out a retry interval that doubles with each try, while messages
+// queued behind it go ahead
+static void testPoolBackoff()
+{
+   PoolModem modem(ISBD_SUCCESS, 3);
+   modem.sessionResult = ISBD_SENDRECEIVE_TIMEOUT;
+   int result = -1;
+   ISBDModemPool<PoolModem, 1, 4> pool(poolResult, &result);
+   pool.addModem(modem);
+   CHECK(pool.submit((const uint8_t *)"retried", 7));
+
+   pool.poll();
+   CHECK_EQUAL(modem.starts, 1);
+   pool.poll(); // fails, and waits
+   CHECK_EQUAL(modem.starts, 1);
+   CHECK_EQUAL(pool.pending(), 1);
+
+   modem.sessionResult = ISBD_SUCCESS;
+   CHECK(pool.submit((const uint8_t *)"fresh", 5));
+   pool.poll();
+   CHECK_EQUAL(modem.starts, 2); // the fresh one
+   pool.poll();
+   CHECK_EQUAL(result, ISBD_SUCCESS);
+   CHECK_EQUAL(modem.starts, 2);
+
+   modem.sessionResult = ISBD_SENDRECEIVE_TIMEOUT;
+   hostAdvanceClock(1000UL * ISBD_POOL_RETRY_INTERVAL);
+   pool.poll();
+   CHECK_EQUAL(modem.starts, 3);
+   pool.poll(); // second failure: twice the wait
+   hostAdvanceClock(1000UL * ISBD_POOL_RETRY_INTERVAL);
+   pool.poll();
+   CHECK_EQUAL(modem.starts, 3);
+   hostAdvanceClock(1000UL * ISBD_POOL_RETRY_INTERVAL);
+   pool.poll();
+   CHECK_EQUAL(modem.starts, 4);
+
+   // Out of tries: reported at once, without another wait
+   pool.poll();
+   CHECK_EQUAL(result, ISBD_SENDRECEIVE_TIMEOUT);
+   CHECK_EQUAL(pool.pending(), 0);
+}
+
+// A session driven by start*() and poll() never blocks, and a second session is refused
+// while the first is in flight
+static void testPolledSession()
+{
+   Fixture f;
+   CHECK(f.begin());
+   f.sim.setSBDIXLatency(300);
+
+   static const uint8_t mt[] = "polled";
+   f.sim.queueMTMessage(mt, sizeof(mt) - 1);
+   uint8_t rx[64];
+   size_t rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.startSendReceiveSBDText("first", rx, rxSize), ISBD_SUCCESS);
+   CHECK_EQUAL(f.modem.startSendSBDText("second"), ISBD_REENTRANT);
+   CHECK_EQUAL(f.modem.sendSBDText("blocking"), ISBD_REENTRANT);
+
+   int result, polls = 0;
+   unsigned long slowest = 0, start = millis();
+   do
+   {
+      unsigned long before = millis();
+      result = f.modem.poll();
+      if (millis() - before > slowest)
+         slowest = millis() - before;
+      ++polls;
+      if (result == ISBD_BUSY)
+         CHECK_EQUAL(f.modem.startSendSBDBinary(mt, 1), ISBD_REENTRANT);
+   } while (result == ISBD_BUSY && millis() - start < 5000);
+
+   CHECK_EQUAL(result, ISBD_SUCCESS);
+   CHECK(polls > 10);
+   CHECK(slowest < 50);
+   CHECK(millis() - start >= 300);
+   CHECK_EQUAL(rxSize, sizeof(mt) - 1);
+   CHECK(memcmp(rx, mt, sizeof(mt) - 1) == 0);
+   CHECK_EQUAL(f.sim.sentMessages().size(), 1);
+   CHECK(sentText(f.sim, 0) == "first");
+   CHECK_EQUAL(f.modem.poll(), ISBD_SUCCESS); // idle
+   CHECK_EQUAL(f.modem.sendSBDText("next"), ISBD_SUCCESS);
+}
+
+// A response longer than the receive ring is read intact, and the backlog it leaves in the
+// serial port counts as one overrun however many reads it takes to clear
+static void testRXOverrun()
+{
+   Fixture f;
+   CHECK(f.begin());
+   CHECK_EQUAL(f.modem.getRXOverrunCount(), 0);
+
+   std::string flood = "\r\n" + std::string(3 * ISBD_RX_BUFFER_SIZE, 'x') + "\r\n+CSQ:3\r\n\r\nOK\r\n";
+   f.sim.scriptResponse("AT+CSQ", flood);
+   int quality = -1;
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS);
+   CHECK_EQUAL(quality, 3);
+   CHECK_EQUAL(f.modem.getRXOverrunCount(), 1);
+
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS); // fits: no overrun
+   CHECK_EQUAL(f.modem.getRXOverrunCount(), 1);
+   f.sim.scriptResponse("AT+CSQ", flood);
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS);
+   CHECK_EQUAL(f.modem.getRXOverrunCount(), 2);
+}
+
+// An +SBDRB length no modem could send fails the session at once rather than waiting for
+// the body
+static void testImpossibleMTSize()
+{
+   Fixture f;
+   CHECK(f.begin());
+   f.modem.adjustATTimeout(5);
+
+   static const uint8_t mt[] = "real";
+   f.sim.queueMTMessage(mt, sizeof(mt) - 1);
+   f.sim.scriptResponse("AT+SBDRB", std::string("\x01\x0F", 2) + "real\r\nOK\r\n"); // 271 bytes
+   uint8_t rx[ISBD_MAX_MESSAGE_LENGTH];
+   size_t rxSize = sizeof(rx);
+   unsigned long start = millis();
+   CHECK_EQUAL(f.modem.sendReceiveSBDText("hi", rx, rxSize), ISBD_PROTOCOL_ERROR);
+   CHECK(millis() - start < 2000);
+
+   rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText(NULL, rx, rxSize), ISBD_SUCCESS);
+}
+
+// Segments, empty ones included, go out as one message: the +SBDWB length and checksum
+// span all of them
+static void testScatterGather()
+{
+   Fixture f;
+   CHECK(f.begin());
+
+   uint8_t header[3] = { 0xFF, 0x00, 0x7F }, body[200], tail[1] = { 0xEE };
+   for (size_t i=0; i<sizeof(body); ++i)
+      body[i] = (uint8_t)(0xFF - i);
+   const ISBDSegment segments[] =
+   {
+      { NULL, 0 },
+      { header, sizeof(header) },
+      { body, 0 },
+      { body, sizeof(body) },
+      { NULL, 0 },
+      { tail, sizeof(tail) },
+      { tail, 0 },
+   };
+   std::vector<uint8_t> expected(header, header + sizeof(header));
+   expected.insert(expected.end(), body, body + sizeof(body));
+   expected.insert(expected.end(), tail, tail + sizeof(tail));
+
+   CHECK_EQUAL(f.modem.sendSBDBinary(segments, sizeof(segments) / sizeof(segments[0])), ISBD_SUCCESS);
+   CHECK_EQUAL(f.sim.sentMessages().size(), 1);
+   CHECK(f.sim.sentMessages()[0] == expected);
+
+   // Polled, with the reply read back as well
+   static const uint8_t mt[] = "ack";
+   f.sim.queueMTMessage(mt, sizeof(mt) - 1);
+   uint8_t rx[16];
+   size_t rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.startSendReceiveSBDBinary(segments + 3, 3, rx, rxSize), ISBD_SUCCESS);
+   int result;
+   while ((result = f.modem.poll()) == ISBD_BUSY)
+      ;
+   CHECK_EQUAL(result, ISBD_SUCCESS);
+   CHECK_EQUAL(f.sim.sentMessages().size(), 2);
+   CHECK(f.sim.sentMessages()[1] == std::vector<uint8_t>(expected.begin() + sizeof(header), expected.end()));
+   CHECK_EQUAL(rxSize, sizeof(mt) - 1);
+}
+
+// Step a polled session through simulated time until the simulator sees another +SBDIX,
+// returning how long that took (limitMs if it didn't happen)
+static unsigned long untilNextSBDIX(Fixture &f, unsigned long limitMs)
+{
+   unsigned long attempts = f.sim.stats().sbdixAttempts;
+   for (unsigned long t = 0; t < limitMs; t += 50)
+   {
+      for (int i=0; i<4 && f.modem.isBusy(); ++i)
+         f.modem.poll();
+      if (f.sim.stats().sbdixAttempts != attempts)
+         return t;
+      hostAdvanceClock(50);
+   }
+   return limitMs;
+}
+
+// With +CIEV indications on, +SBDIX goes out as soon as the sky clears, but never before the
+// recharge floor after a failed attempt; while the sky stays blocked, blind attempts come
+// further and further apart
+static void testIndicationScheduling()
+{
+   Fixture f;
+   f.sim.setSignalQuality(1);
+   f.modem.setPowerProfile(IridiumSBD::DEFAULT_POWER_PROFILE); // 10 s between attempts
+   f.modem.useSignalIndications(true, 2);
+   CHECK(f.begin());
+   for (int i=0; i<5; ++i)
+      f.sim.queueSBDIXStatus(32);
+
+   CHECK_EQUAL(f.modem.startSendSBDText("sky"), ISBD_SUCCESS);
+   CHECK_EQUAL(untilNextSBDIX(f, 5000), 5000); // below the threshold: nothing sent
+
+   f.sim.setSignalQuality(3); // +CIEV:0,3
+   CHECK(untilNextSBDIX(f, 5000) <= 200);
+
+   // Fails with the link still usable: the next try waits out the 10 s floor regardless
+   f.sim.setSignalQuality(4);
+   unsigned long floor = untilNextSBDIX(f, 60000);
+   CHECK(floor >= 10000 && floor <= 10500);
+
+   // Blocked sky: blind attempts after the floor plus a doubling backoff
+   f.sim.setSignalQuality(1);
+   unsigned long first = untilNextSBDIX(f, 120000);
+   unsigned long second = untilNextSBDIX(f, 120000);
+   unsigned long third = untilNextSBDIX(f, 120000);
+   CHECK(first >= 20000 && first <= 20500);
+   CHECK(second >= 30000 && second <= 30500);
+   CHECK(third >= 50000 && third <= 50500);
+
+   // The sky clears mid-backoff: straight in once the floor has passed
+   CHECK_EQUAL(untilNextSBDIX(f, 15000), 15000);
+   f.sim.setSignalQuality(5);
+   CHECK(untilNextSBDIX(f, 60000) <= 200);
+   int result;
+   while ((result = f.modem.poll()) == ISBD_BUSY)
+      hostAdvanceClock(50);
+   CHECK_EQUAL(result, ISBD_SUCCESS);
+   CHECK_EQUAL(f.sim.stats().sbdixAttempts, 6);
+}
+
+// Iridium time as getSystemTimeEpoch() reports it, in Unix milliseconds
+static unsigned long long systemTimeMs(Fixture &f)
+{
+   uint32_t unixSeconds = 0;
+   uint16_t ms = 0;
+   CHECK_EQUAL(f.modem.getSystemTimeEpoch(unixSeconds, ms), ISBD_SUCCESS);
+   return 1000ULL * unixSeconds + ms;
+}
+
+// Iridium time for a -MSSTM tick count plus ms, in Unix milliseconds
+static unsigned long long ticksMs(uint32_t ticks, unsigned long ms = 0)
+{
+   return 1000ULL * ISBD_IRIDIUM_EPOCH + 90ULL * ticks + ms;
+}
+
+// A -MSSTM reading answers for ISBD_MSSTM_CACHE_TIME, and lets the +SBDIX loop skip the
+// query the erratum workaround would otherwise make
+static void testSystemTimeCache()
+{
+   Fixture f;
+   f.sim.setFirmwareVersion("TA12003"); // needs the MSSTM workaround
+   CHECK(f.begin());
+   uint32_t ticks = 0x12345678;
+   f.sim.setSystemTime(ticks);
+
+   CHECK_EQUAL(f.modem.sendSBDText("cold"), ISBD_SUCCESS);
+   unsigned long queries = f.sim.stats().msstmQueries;
+   CHECK(queries >= 1);
+   hostAdvanceClock(1000UL * ISBD_MSSTM_CACHE_TIME + 1200);
+   ticks += (1000UL * ISBD_MSSTM_CACHE_TIME + 1200) / 90;
+   f.sim.setSystemTime(ticks);
+
+   unsigned long long first = systemTimeMs(f);
+   CHECK_EQUAL(f.sim.stats().msstmQueries, queries + 1);
+   CHECK(first >= ticksMs(ticks) && first < ticksMs(ticks, 100));
+   hostAdvanceClock(60000);
+   f.sim.setSystemTime(ticks + 1); // not asked: the cache answers
+   unsigned long long later = systemTimeMs(f);
+   CHECK(later >= ticksMs(ticks, 60000) && later < ticksMs(ticks, 60100));
+   CHECK_EQUAL(f.modem.sendSBDText("warm"), ISBD_SUCCESS);
+   CHECK_EQUAL(f.sim.stats().msstmQueries, queries + 1);
+
+   hostAdvanceClock(1000UL * ISBD_MSSTM_CACHE_TIME);
+   CHECK_EQUAL(f.modem.sendSBDText("stale"), ISBD_SUCCESS);
+   CHECK_EQUAL(f.sim.stats().msstmQueries, queries + 2);
+}
+
+// Successive readings teach the library how fast millis() runs against Iridium time; a
+// reading that no clock drift could explain, or one after a very long gap, only re-anchors
+static void testClockDrift()
+{
+   Fixture f;
+   CHECK(f.begin());
+
+   // Local clock 1000 ppm slow: 1000 s of millis() is 1001 s of Iridium time
+   uint32_t ticks = 0x01000000;
+   f.sim.setSystemTime(ticks);
+   systemTimeMs(f);
+   for (int i=0; i<10; ++i)
+   {
+      hostAdvanceClock(1000000);
+      ticks += 1001000 / 90;
+      f.sim.setSystemTime(ticks);
+      systemTimeMs(f);
+   }
+
+   // Between readings, the prediction carries the correction (500 ms of it over 500 s)
+   hostAdvanceClock(500000);
+   long long error = (long long)(systemTimeMs(f) - ticksMs(ticks, 500500));
+   CHECK(error > -150 && error < 150);
+
+   // The modem's clock jumps a day: taken as the new time, but not as drift
+   hostAdvanceClock(500000);
+   ticks += 1001000 / 90 + 86400000 / 90;
+   f.sim.setSystemTime(ticks);
+   systemTimeMs(f);
+   hostAdvanceClock(500000);
+   error = (long long)(systemTimeMs(f) - ticksMs(ticks, 500500));
+   CHECK(error > -150 && error < 150);
+
+   // Two days later the reading can't be trusted to measure drift either, but still counts
+   hostAdvanceClock(2 * 86400000UL - 500000);
+   ticks += 2 * 86400000 / 90 + 172800000 / 90 / 10; // a wildly fast 10%
+   f.sim.setSystemTime(ticks);
+   systemTimeMs(f);
+   hostAdvanceClock(500000);
+   error = (long long)(systemTimeMs(f) - ticksMs(ticks, 500500));
+   CHECK(error > -150 && error < 150);
+}
+
+static bool sameTM(const struct tm &a, const struct tm &b)
+{
+   return a.tm_year == b.tm_year && a.tm_mon == b.tm_mon && a.tm_mday == b.tm_mday &&
+      a.tm_hour == b.tm_hour && a.tm_min == b.tm_min && a.tm_sec == b.tm_sec &&
+      a.tm_wday == b.tm_wday && a.tm_yday == b.tm_yday;
+}
+
+// epochToTM() and getSystemTimeEpoch() against the C library
+static void testSystemTimeConversion()
+{
+   static const uint32_t dates[] =
+   {
+      0,                    // 1970-01-01 00:00:00
+      ISBD_IRIDIUM_EPOCH,   // 2014-05-11 14:23:55
+      951782400UL,          // 2000-02-29 00:00:00, leap by the 400-year rule
+      978307199UL,          // 2000-12-31 23:59:59
+      1456790399UL,         // 2016-02-29 23:59:59
+      1456790400UL,         // 2016-03-01 00:00:00
+      1483228799UL,         // 2016-12-31 23:59:59, day 365 of a leap year
+      1483228800UL,         // 2017-01-01 00:00:00
+      1546300799UL,         // 2018-12-31 23:59:59
+      1709251199UL,         // 2024-02-29 23:59:59
+      4102444799UL,         // 2099-12-31 23:59:59
+      4107542399UL,         // 2100-02-28 23:59:59, not a leap year
+      4107542400UL,         // 2100-03-01 00:00:00
+   };
+   for (size_t i=0; i<sizeof(dates) / sizeof(dates[0]); ++i)
+   {
+      struct tm ours, theirs;
+      time_t t = (time_t)dates[i];
+      gmtime_r(&t, &theirs);
+      IridiumSBD::epochToTM(dates[i], ours);
+      if (!sameTM(ours, theirs))
+         printf("    %lu converted to %04d-%02d-%02d %02d:%02d:%02d\n", (unsigned long)dates[i],
+            ours.tm_year + 1900, ours.tm_mon + 1, ours.tm_mday, ours.tm_hour, ours.tm_min, ours.tm_sec);
+      CHECK(sameTM(ours, theirs));
+   }
+
+   // -MSSTM ticks: the epoch itself, sub-second values either side of a carry, and the last tick
+   static const uint32_t ticks[] = { 0, 1, 11, 12, 1000, 0x1234567, 0xFFFFFFFFUL };
+   Fixture f;
+   CHECK(f.begin());
+   for (size_t i=0; i<sizeof(ticks) / sizeof(ticks[0]); ++i)
+   {
+      hostAdvanceClock(1000UL * ISBD_MSSTM_CACHE_TIME); // ask the modem every time
+      f.sim.setSystemTime(ticks[i]);
+      unsigned long long expected = ticksMs(ticks[i]), actual = systemTimeMs(f);
+      CHECK(actual >= expected && actual < expected + 10);
+
+      struct tm ours, theirs;
+      time_t t = (time_t)(expected / 1000);
+      gmtime_r(&t, &theirs);
+      if (expected % 1000 < 900) // no second boundary between the two calls
+      {
+         CHECK_EQUAL(f.modem.getSystemTime(ours), ISBD_SUCCESS);
+         CHECK(sameTM(ours, theirs));
+      }
+   }
+}
+
+// Stands in for the host UART: follows each rate the library asks for, and notes it
+struct HostPort
+{
+   SimulatedModem *sim;
+   std::vector<unsigned long> rates;
+};
+
+static bool setHostRate(void *context, unsigned long baud)
+{
+   HostPort *port = (HostPort *)context;
+   port->rates.push_back(baud);
+   port->sim->setHostBaudRate(baud);
+   return true;
+}
+
+// Run waits in simulated time, so lost probes don't cost a second each
+static bool fastForward(void *context)
+{
+   (void)context;
+   hostAdvanceClock(10);
+   return true;
+}
+
+// AT+IPR moves both ends to the new rate once "AT" is answered there; a modem that says OK
+// but stays put is found by the probes and the host goes back to the old rate
+static void testBaudRateNegotiation()
+{
+   int quality;
+   {
+      Fixture f;
+      f.sim.setBaudRate(ISBD_DEFAULT_BAUD_RATE);
+      CHECK(f.begin());
+      HostPort port = { &f.sim };
+      unsigned long commands = f.sim.stats().commands;
+      CHECK_EQUAL(f.modem.negotiateBaudRate(115200, setHostRate, &port), ISBD_SUCCESS);
+      CHECK_EQUAL(port.rates.size(), 1);
+      CHECK_EQUAL(port.rates[0], 115200);
+      CHECK_EQUAL(f.sim.baudRate(), 115200);
+      CHECK_EQUAL(f.modem.getBaudRate(), 115200);
+      CHECK_EQUAL(f.sim.stats().commands, commands + 2); // AT+IPR=9, then AT at the new rate
+      CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS);
+   }
+   {
+      // Refused outright: the host port is left alone
+      Fixture f;
+      f.sim.setBaudRate(ISBD_DEFAULT_BAUD_RATE);
+      f.sim.setMaxBaudRate(57600);
+      CHECK(f.begin());
+      HostPort port = { &f.sim };
+      CHECK_EQUAL(f.modem.negotiateBaudRate(115200, setHostRate, &port), ISBD_UNSUPPORTED_BAUD);
+      CHECK_EQUAL(port.rates.size(), 0);
+      CHECK_EQUAL(f.modem.getBaudRate(), ISBD_DEFAULT_BAUD_RATE);
+   }
+   {
+      Fixture f;
+      f.sim.setBaudRate(ISBD_DEFAULT_BAUD_RATE);
+      f.sim.setBaudRateStuck(true);
+      CHECK(f.begin());
+      f.modem.setCallback(fastForward);
+      HostPort port = { &f.sim };
+      CHECK_EQUAL(f.modem.negotiateBaudRate(115200, setHostRate, &port), ISBD_UNSUPPORTED_BAUD);
+      CHECK_EQUAL(port.rates.size(), 2);
+      CHECK_EQUAL(port.rates[0], 115200);
+      CHECK_EQUAL(port.rates[1], ISBD_DEFAULT_BAUD_RATE);
+      CHECK_EQUAL(f.sim.baudRate(), ISBD_DEFAULT_BAUD_RATE);
+      CHECK_EQUAL(f.modem.getBaudRate(), ISBD_DEFAULT_BAUD_RATE);
+      CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS);
+   }
+}
+
+// Responses whose fields are missing, out of range or not numbers are rejected, not parsed
+// as far as they go
+static void testMalformedFields()
+{
+   Fixture f;
+   CHECK(f.begin());
+
+   f.sim.scriptResponse("AT+SBDIX", "\r\n+SBDIX: 0, 5, 0, 0, 0\r\n\r\nOK\r\n"); // five fields
+   CHECK_EQUAL(f.modem.sendSBDText("short"), ISBD_PROTOCOL_ERROR);
+   f.sim.scriptResponse("AT+SBDIX", "\r\n+SBDIX: 65536, 5, 0, 0, 0, 0\r\n\r\nOK\r\n");
+   CHECK_EQUAL(f.modem.sendSBDText("range"), ISBD_PROTOCOL_ERROR);
+   f.sim.scriptResponse("AT+SBDIX", "\r\n+SBDIX: 0, 5, 0, 0, 0, 0, 0\r\n\r\nOK\r\n"); // seven
+   CHECK_EQUAL(f.modem.sendSBDText("long"), ISBD_PROTOCOL_ERROR);
+
+   int quality = -1;
+   f.sim.scriptResponse("AT+CSQ", "\r\n+CSQ:x\r\n\r\nOK\r\n");
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_PROTOCOL_ERROR);
+   f.sim.scriptResponse("AT+CSQ", "\r\n+CSQ:6\r\n\r\nOK\r\n"); // bars go to 5
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_PROTOCOL_ERROR);
+   CHECK_EQUAL(quality, -1);
+
+   // Anything but eight hex digits from -MSSTM means the modem has no system time yet
+   struct tm t;
+   f.sim.scriptResponse("AT-MSSTM", "\r\n-MSSTM: 1234567g\r\n\r\nOK\r\n");
+   CHECK_EQUAL(f.modem.getSystemTime(t), ISBD_NO_NETWORK);
+   f.sim.scriptResponse("AT-MSSTM", "\r\n-MSSTM: \r\n\r\nOK\r\n");
+   CHECK_EQUAL(f.modem.getSystemTime(t), ISBD_NO_NETWORK);
+
+   // The same modem answering properly is fine
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS);
+   CHECK_EQUAL(f.modem.getSystemTime(t), ISBD_SUCCESS);
+   CHECK_EQUAL(f.modem.sendSBDText("good"), ISBD_SUCCESS);
+}
+
+static void countRecord(void *context, const ISBDTraceRecord &record)
+{
+   (void)record;
+   ++*(int *)context;
+}
+
+// The lean instantiation, bound to the simulator's own type: sessions work as usual, with
+// the MSSTM workaround, trace records and metrics compiled out
+static void testMinimalPolicy()
+{
+   SimulatedModem sim;
+   sim.setFirmwareVersion("TA12003");
+   BasicIridiumSBD<SimulatedModem, ISBDMinimalPolicy> modem(sim);
+   ISBDMetrics metrics;
+   memset(&metrics, 0, sizeof(metrics));
+   int records = 0;
+   modem.setMetrics(&metrics);
+   modem.setTraceSink(countRecord, &records);
+   CHECK_EQUAL(modem.begin(), ISBD_SUCCESS);
+
+   static const uint8_t mt[] = "lean";
+   sim.queueMTMessage(mt, sizeof(mt) - 1);
+   uint8_t mo[] = { 1, 2, 3 }, rx[16];
+   size_t rxSize = sizeof(rx);
+   CHECK_EQUAL(modem.sendReceiveSBDBinary(mo, sizeof(mo), rx, rxSize), ISBD_SUCCESS);
+   CHECK_EQUAL(rxSize, sizeof(mt) - 1);
+   CHECK(memcmp(rx, mt, sizeof(mt) - 1) == 0);
+   CHECK(sim.sentMessages()[0] == std::vector<uint8_t>(mo, mo + sizeof(mo)));
+   CHECK_EQUAL(sim.stats().msstmQueries, 0);
+
+   CHECK_EQUAL(modem.startSendSBDText("polled"), ISBD_SUCCESS);
+   int result;
+   while ((result = modem.poll()) == ISBD_BUSY)
+      ;
+   CHECK_EQUAL(result, ISBD_SUCCESS);
+   CHECK(sentText(sim, 1) == "polled");
+
+   int quality;
+   struct tm t;
+   CHECK_EQUAL(modem.getSignalQuality(quality), ISBD_SUCCESS);
+   CHECK_EQUAL(modem.getSystemTime(t), ISBD_SUCCESS);
+   CHECK_EQUAL(records, 0);
+   CHECK_EQUAL(metrics.sessions, 0);
+   CHECK_EQUAL(metrics.bytesOut, 0);
+}
+
+static void captureRecord(void *context, const ISBDTraceRecord &record)
+{
+   ((std::vector<ISBDTraceRecord> *)context)->push_back(record);
+}
+
+// A record raised inside a response line waits for the line to end; when it never does,
+// the end of the response delivers it, in order, before the session reports its result
+static void testTraceDelivery()
+{
+   Fixture f;
+   CHECK(f.begin());
+   std::vector<ISBDTraceRecord> records;
+   f.modem.setTraceSink(captureRecord, &records);
+   f.modem.adjustATTimeout(1);
+
+   // Follows the echoed "AT+SBDRB\r" directly: a bad checksum and no OK
+   static const uint8_t mt[] = "real";
+   f.sim.queueMTMessage(mt, sizeof(mt) - 1);
+   f.sim.scriptResponse("AT+SBDRB", std::string("\x00\x04real\x00\x00", 8));
+   uint8_t rx[16];
+   size_t rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText("hi", rx, rxSize), ISBD_PROTOCOL_ERROR);
+
+   std::vector<uint8_t> events;
+   for (size_t i=0; i<records.size(); ++i)
+   {
+      events.push_back(records[i].event);
+      if (i > 0)
+         CHECK(records[i].timestamp >= records[i - 1].timestamp);
+   }
+   static const uint8_t expected[] = { ISBD_EVENT_SBDIX, ISBD_EVENT_MT_CHECKSUM };
+   CHECK(events == std::vector<uint8_t>(expected, expected + sizeof(expected)));
+   CHECK_EQUAL(records.back().args[0], 0);
+   CHECK_EQUAL(records.back().args[1], 'r' + 'e' + 'a' + 'l');
+
+   // Nothing is left behind to surface with the next command's records
+   records.clear();
+   int quality;
+   CHECK_EQUAL(f.modem.getSignalQuality(quality), ISBD_SUCCESS);
+   CHECK(records.empty());
+}
+
+static unsigned long latencySum(const ISBDMetrics &m, int command)
+{
+   unsigned long sum = 0;
+   for (int i=0; i<ISBD_LATENCY_BUCKETS; ++i)
+      sum += m.latency[command][i];
+   return sum;
+}
+
+// Counters read back after a scripted session match what crossed the line, and stick at
+// their maximum rather than wrapping
+static void testMetrics()
+{
+   Fixture f;
+   CHECK(f.begin());
+   f.modem.setCallback(fastForward);
+   ISBDMetrics m;
+   memset(&m, 0, sizeof(m));
+   f.modem.setMetrics(&m);
+   f.sim.resetStats();
+
+   static const uint8_t mt[] = "counted";
+   f.sim.queueMTMessage(mt, sizeof(mt) - 1);
+   f.sim.queueSBDIXStatus(32); // no network service, then success
+   uint8_t rx[16];
+   size_t rxSize = sizeof(rx);
+   CHECK_EQUAL(f.modem.sendReceiveSBDText("metered", rx, rxSize), ISBD_SUCCESS);
+
+   const int failSlot = 32 < ISBD_MO_STATUS_SLOTS ? 32 : ISBD_MO_STATUS_SLOTS - 1;
+   CHECK_EQUAL(m.sessions, 1);
+   CHECK_EQUAL(m.attempts[2], 1);
+   CHECK_EQUAL(m.sbdixAttempts, 2);
+   CHECK_EQUAL(m.moStatus[0], 1);
+   CHECK_EQUAL(m.moStatus[failSlot], 1);
+   CHECK_EQUAL(m.mtStatus[1], 1);
+   CHECK_EQUAL(m.mtStatus[2], 1); // the failed attempt couldn't check mail
+   CHECK_EQUAL(latencySum(m, ISBD_COMMAND_SBDIX), 2);
+   CHECK_EQUAL(latencySum(m, ISBD_COMMAND_SBDW), 1);
+   CHECK_EQUAL(latencySum(m, ISBD_COMMAND_SBDRB), 1);
+   CHECK_EQUAL(m.timeouts[ISBD_COMMAND_SBDIX], 0);
+   CHECK_EQUAL(m.bytesOut, f.sim.stats().bytesFromHost);
+   CHECK_EQUAL(m.bytesIn, f.sim.stats().bytesToHost);
+
+   // Near the top, every counter saturates
+   m.sessions = m.moStatus[0] = m.mtStatus[0] = 0xFFFF;
+   m.sbdixAttempts = 0xFFFFFFFFUL;
+   m.bytesOut = m.bytesIn = 0xFFFFFFF0UL;
+   m.awakeTime = 0xFFFFFFF0UL;
+   CHECK_EQUAL(f.modem.sendSBDText("saturated"), ISBD_SUCCESS);
+   CHECK_EQUAL(m.sessions, 0xFFFF);
+   CHECK_EQUAL(m.moStatus[0], 0xFFFF);
+   CHECK_EQUAL(m.mtStatus[0], 0xFFFF);
+   CHECK_EQUAL(m.sbdixAttempts, 0xFFFFFFFFUL);
+   CHECK_EQUAL(m.bytesOut, 0xFFFFFFFFUL);
+   CHECK_EQUAL(m.bytesIn, 0xFFFFFFFFUL);
+
+   hostAdvanceClock(1000);
+   ISBDMetrics snapshot;
+   f.modem.snapshotMetrics(snapshot);
+   CHECK_EQUAL(snapshot.awakeTime, 0xFFFFFFFFUL);
+}
+
+static const struct
+{
+   const char *name;
+   void (*run)();
+} tests[] =
+{
+   { "send/receive", testSendReceive },
+   { "no network", testNoNetwork },
+   { "SBDIX fatal status", testSBDIXFatal },
+   { "command answering ERROR", testFailedCommand },
+   { "SBDRING", testRing },
+   { "unsolicited codes mid-response", testURCMidResponse },
+   { "ERROR and SBDWB result 2 fail fast", testErrorFailsFast },
+   { "OK/ERROR only as whole lines", testFinalResultMidLine },
+   { "MT checksum verified", testMTChecksum },
+   { "drainMailbox", testDrainMailbox },
+   { "fast wake", testFastWake },
+   { "echo off", testEchoOff },
+   { "outbox priority and eviction", testOutbox },
+   { "journal torn write", testJournal },
+   { "MT history suppresses repeats", testMTHistory },
+   { "pool start refusal", testPoolRefusal },
+   { "start*() and poll()", testPolledSession },
+   { "receive ring overrun counted once", testRXOverrun },
+   { "impossible MT size", testImpossibleMTSize },
+   { "scatter-gather send", testScatterGather },
+   { "+CIEV-driven SBDIX scheduling", testIndicationScheduling },
+   { "system time cache", testSystemTimeCache },
+   { "clock drift learning", testClockDrift },
+   { "system time conversion", testSystemTimeConversion },
+   { "AT+IPR negotiation and fallback", testBaudRateNegotiation },
+   { "malformed response fields", testMalformedFields },
+   { "ISBDMinimalPolicy instantiation", testMinimalPolicy },
+   { "trace records outlive unfinished lines", testTraceDelivery },
+   { "metrics readback and saturation", testMetrics },
+   { "pool scores on +CSQ without +CIEV", testPoolSignal },
+   { "pool retry backoff", testPoolBackoff },
+   { "outbox eviction while sending", testOutboxClaimed },
+};
+
+int main()
+{
+   int failed = 0;
+   for (size_t i=0; i<sizeof(tests) / sizeof(tests[0]); ++i)
+   {
+      int before = failures;
+      tests[i].run(); // failed checks are listed above the test's name
+      printf("%-40s %s\n", tests[i].name, failures == before ? "ok" : "FAILED");
+      if (failures != before)
+         ++failed;
+   }
+   printf("%d of %d tests failed\n", failed, (int)(sizeof(tests) / sizeof(tests[0])));
+   return failed != 0;
+}
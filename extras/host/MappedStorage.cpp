@@ -0,0 +1,109 @@
+/*
+MappedStorage - An ISBDStorage over a memory-mapped file.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MappedStorage.h"
+
+MappedStorage::MappedStorage() : base(NULL), pageSize(0), pageCount(0), eraseCount(0)
+{
+}
+
+MappedStorage::~MappedStorage()
+{
+   close();
+}
+
+bool MappedStorage::open(const char *path, size_t pageSize, uint16_t pageCount)
+{
+   close();
+   int fd = ::open(path, O_RDWR | O_CREAT, 0644);
+   if (fd < 0)
+      return false;
+
+   size_t length = pageSize * pageCount;
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (st.st_size != 0 && (size_t)st.st_size != length) || ftruncate(fd, length) != 0)
+   {
+      ::close(fd);
+      return false;
+   }
+
+   void *p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (p == MAP_FAILED)
+      return false;
+
+   base = (uint8_t *)p;
+   this->pageSize = pageSize;
+   this->pageCount = pageCount;
+   if (st.st_size == 0) // a new file reads as zeros; make it look like erased flash
+   {
+      memset(base, 0xFF, length);
+      sync(0, length);
+   }
+   return true;
+}
+
+void MappedStorage::close()
+{
+   if (base)
+      munmap(base, pageSize * pageCount);
+   base = NULL;
+}
+
+ISBDStorage MappedStorage::storage()
+{
+   ISBDStorage s = { pageSize, pageCount, read, write, erase, map, this };
+   return s;
+}
+
+// msync() wants a page-aligned start
+bool MappedStorage::sync(uint32_t address, size_t size)
+{
+   size_t align = (size_t)sysconf(_SC_PAGESIZE);
+   size_t start = address - address % align;
+   return msync(base + start, address + size - start, MS_SYNC) == 0;
+}
+
+bool MappedStorage::read(void *context, uint32_t address, uint8_t *data, size_t size)
+{
+   MappedStorage *self = (MappedStorage *)context;
+   if (!self->base || address + size > self->pageSize * self->pageCount)
+      return false;
+   memcpy(data, self->base + address, size);
+   return true;
+}
+
+bool MappedStorage::write(void *context, uint32_t address, const uint8_t *data, size_t size)
+{
+   MappedStorage *self = (MappedStorage *)context;
+   if (!self->base || address + size > self->pageSize * self->pageCount)
+      return false;
+   for (size_t i=0; i<size; ++i)
+      self->base[address + i] &= data[i];
+   return self->sync(address, size);
+}
+
+bool MappedStorage::erase(void *context, uint16_t page)
+{
+   MappedStorage *self = (MappedStorage *)context;
+   if (!self->base || page >= self->pageCount)
+      return false;
+   memset(self->base + (size_t)page * self->pageSize, 0xFF, self->pageSize);
+   ++self->eraseCount;
+   return self->sync((uint32_t)page * self->pageSize, self->pageSize);
+}
+
+const uint8_t *MappedStorage::map(void *context, uint32_t address)
+{
+   return ((MappedStorage *)context)->base + address;
+}
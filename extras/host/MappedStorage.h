@@ -0,0 +1,45 @@
+/*
+MappedStorage - An ISBDStorage over a memory-mapped file, so an ISBDJournal on a Linux
+gateway survives restarts.  Writes behave like NOR flash (they can only clear bits) and
+are flushed to disk before they return, so the journal's crash safety carries over.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef MAPPED_STORAGE_H
+#define MAPPED_STORAGE_H
+
+#include <IridiumSBD.h>
+
+class MappedStorage
+{
+public:
+   MappedStorage();
+   ~MappedStorage();
+
+   // Create path if need be (erased), and map pageCount pages of pageSize bytes
+   bool open(const char *path, size_t pageSize, uint16_t pageCount);
+   void close();
+
+   // The storage to hand to ISBDJournal; valid while this stays open
+   ISBDStorage storage();
+
+   unsigned long erases() const { return eraseCount; }
+
+private:
+   uint8_t *base;
+   size_t pageSize;
+   uint16_t pageCount;
+   unsigned long eraseCount;
+
+   bool sync(uint32_t address, size_t size);
+   static bool read(void *context, uint32_t address, uint8_t *data, size_t size);
+   static bool write(void *context, uint32_t address, const uint8_t *data, size_t size);
+   static bool erase(void *context, uint16_t page);
+   static const uint8_t *map(void *context, uint32_t address);
+};
+
+#endif
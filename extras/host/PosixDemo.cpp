@@ -0,0 +1,105 @@
+/*
+PosixDemo - Runs IridiumSBD over PosixSerial against a SimulatedModem on the far side of a
+pseudo-terminal, and compares the host CPU used during a long +SBDIX by the Stream
+interface (which polls) and PosixIridiumSBD (which waits in epoll).
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+#include "PosixSerial.h"
+#include "SimulatedModem.h"
+
+// A SimulatedModem serving the slave side of a pty, pumped by its own thread
+class PtyModem
+{
+public:
+   SimulatedModem sim;
+
+   bool open()
+   {
+      master = posix_openpt(O_RDWR | O_NOCTTY);
+      return master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0;
+   }
+   const char *path() { return ptsname(master); }
+   void start() { running = true; pump = std::thread(&PtyModem::run, this); }
+   void stop() { running = false; pump.join(); ::close(master); }
+
+private:
+   int master;
+   std::atomic<bool> running;
+   std::thread pump;
+
+   void run()
+   {
+      uint8_t buf[256];
+      while (running)
+      {
+         struct pollfd pfd = { master, POLLIN, 0 };
+         if (poll(&pfd, 1, 1) > 0)
+         {
+            ssize_t n = ::read(master, buf, sizeof(buf));
+            if (n > 0)
+               sim.write(buf, n);
+         }
+         size_t n = 0;
+         while (n < sizeof(buf) && sim.available() > 0)
+            buf[n++] = sim.read();
+         if (n > 0 && ::write(master, buf, n) < 0)
+            break;
+      }
+   }
+};
+
+static double threadCpuMillis()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+   return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// begin() and one sendSBDText() with a slow +SBDIX, reporting this thread's CPU use
+template <class Modem, class Port>
+static int run(const char *name, unsigned long sbdixLatency)
+{
+   PtyModem pty;
+   PosixSerial serial;
+   if (!pty.open() || !serial.open(pty.path()))
+   {
+      printf("can't open pty\n");
+      return 1;
+   }
+   pty.sim.setSBDIXLatency(sbdixLatency);
+   pty.start();
+
+   Modem modem(static_cast<Port &>(serial));
+   unsigned long start = millis();
+   double cpu = threadCpuMillis();
+   int err = modem.begin();
+   if (err == ISBD_SUCCESS)
+      err = modem.sendSBDText("Hello from a Linux gateway");
+   cpu = threadCpuMillis() - cpu;
+   unsigned long elapsed = millis() - start;
+   pty.stop();
+
+   const PosixSerial::Stats &s = serial.stats();
+   printf("%-16s err=%-2d %6lu ms  CPU %7.1f ms (%5.1f%%)  read() %-8lu waits %lu\n",
+      name, err, elapsed, cpu, 100.0 * cpu / elapsed, s.readCalls, s.waits);
+   return err != ISBD_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned long sbdixLatency = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000;
+   printf("begin() + sendSBDText() over a pty, %lu ms +SBDIX\n", sbdixLatency);
+   return run<IridiumSBD, Stream>("Stream (polls)", sbdixLatency)
+      | run<PosixIridiumSBD, PosixSerial>("PosixIridiumSBD", sbdixLatency);
+}
@@ -0,0 +1,203 @@
+/*
+PosixSerial - A Stream over a POSIX serial device (termios).
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+#include "PosixSerial.h"
+
+PosixSerial::PosixSerial() :
+   port(-1),
+   poller(-1),
+   head(0),
+   tail(0)
+{
+   resetStats();
+}
+
+PosixSerial::~PosixSerial()
+{
+   close();
+}
+
+void PosixSerial::resetStats()
+{
+   memset(&counters, 0, sizeof(counters));
+}
+
+bool PosixSerial::open(const char *path, unsigned long baud)
+{
+   close();
+   port = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+   if (port < 0)
+      return false;
+
+   struct termios tio;
+   if (tcgetattr(port, &tio) != 0)
+   {
+      close();
+      return false;
+   }
+   cfmakeraw(&tio);
+   tio.c_cflag |= CLOCAL | CREAD;
+   tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+   tio.c_cc[VMIN] = 0;
+   tio.c_cc[VTIME] = 0;
+   if (tcsetattr(port, TCSANOW, &tio) != 0 || !setBaudRate(baud))
+   {
+      close();
+      return false;
+   }
+
+#if defined(__linux__)
+   poller = epoll_create1(EPOLL_CLOEXEC);
+   if (poller >= 0)
+   {
+      struct epoll_event ev;
+      memset(&ev, 0, sizeof(ev));
+      ev.events = EPOLLIN;
+      ev.data.fd = port;
+      if (epoll_ctl(poller, EPOLL_CTL_ADD, port, &ev) != 0)
+      {
+         ::close(poller);
+         poller = -1;
+      }
+   }
+#endif
+   return true;
+}
+
+void PosixSerial::close()
+{
+   if (poller >= 0)
+      ::close(poller);
+   if (port >= 0)
+      ::close(port);
+   port = poller = -1;
+   head = tail = 0;
+}
+
+bool PosixSerial::setBaudRate(unsigned long baud)
+{
+   static const struct { unsigned long baud; speed_t speed; } speeds[] =
+   {
+      { 600, B600 }, { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+      { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 }
+   };
+
+   struct termios tio;
+   if (port < 0 || tcgetattr(port, &tio) != 0)
+      return false;
+   for (size_t i=0; i<sizeof(speeds) / sizeof(speeds[0]); ++i)
+      if (speeds[i].baud == baud)
+      {
+         cfsetispeed(&tio, speeds[i].speed);
+         cfsetospeed(&tio, speeds[i].speed);
+         return tcsetattr(port, TCSADRAIN, &tio) == 0;
+      }
+   return false;
+}
+
+bool PosixSerial::baudRateHook(void *port, unsigned long baud)
+{
+   return static_cast<PosixSerial *>(port)->setBaudRate(baud);
+}
+
+// Read whatever the device has, up to a buffer's worth, without blocking
+bool PosixSerial::fill()
+{
+   if (head != tail)
+      return true;
+   if (port < 0)
+      return false;
+
+   ++counters.readCalls;
+   ssize_t n = ::read(port, buffer, sizeof(buffer));
+   if (n <= 0)
+      return false;
+   head = 0;
+   tail = n;
+   return true;
+}
+
+bool PosixSerial::waitForInput(unsigned long ms)
+{
+   if (fill())
+      return true;
+   if (port < 0)
+      return false;
+
+   int timeout = ms > 0x7FFFFFFFUL ? -1 : (int)ms;
+   int ready;
+   ++counters.waits;
+#if defined(__linux__)
+   if (poller >= 0)
+   {
+      struct epoll_event ev;
+      ready = epoll_wait(poller, &ev, 1, timeout);
+   }
+   else
+#endif
+   {
+      struct pollfd pfd = { port, POLLIN, 0 };
+      ready = poll(&pfd, 1, timeout);
+   }
+   return ready > 0 && fill();
+}
+
+int PosixSerial::available()
+{
+   fill();
+   return (int)(tail - head);
+}
+
+int PosixSerial::read()
+{
+   return fill() ? buffer[head++] : -1;
+}
+
+int PosixSerial::peek()
+{
+   return fill() ? buffer[head] : -1;
+}
+
+size_t PosixSerial::write(uint8_t c)
+{
+   return write(&c, 1);
+}
+
+size_t PosixSerial::write(const uint8_t *data, size_t size)
+{
+   size_t done = 0;
+   while (done < size && port >= 0)
+   {
+      ++counters.writeCalls;
+      ssize_t n = ::write(port, data + done, size - done);
+      if (n > 0)
+      {
+         done += n;
+      }
+      else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      {
+         // Output queue full: wait for room rather than dropping characters
+         struct pollfd pfd = { port, POLLOUT, 0 };
+         poll(&pfd, 1, 1000);
+      }
+      else
+      {
+         break;
+      }
+   }
+   return done;
+}
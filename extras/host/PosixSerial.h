@@ -0,0 +1,75 @@
+/*
+PosixSerial - A Stream over a POSIX serial device (termios) for running IridiumSBD on
+Linux gateways.  Input is read in blocks into a local buffer, and the library waits for
+it with epoll (poll elsewhere) instead of spinning on available().
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef POSIX_SERIAL_H
+#define POSIX_SERIAL_H
+
+#include <IridiumSBD.h>
+
+class PosixSerial : public Stream
+{
+public:
+   PosixSerial();
+   ~PosixSerial();
+
+   bool open(const char *path, unsigned long baud = ISBD_DEFAULT_BAUD_RATE); // raw 8N1, no flow control
+   void close();
+   bool setBaudRate(unsigned long baud);
+   static bool baudRateHook(void *port, unsigned long baud); // for negotiateBaudRate(), context = the port
+   int fd() const { return port; } // for an application's own event loop
+
+   // Block until input is buffered or ms pass; true if there is input
+   bool waitForInput(unsigned long ms);
+
+   // Stream interface
+   int available();
+   int read();
+   int peek();
+   size_t write(uint8_t c);
+   size_t write(const uint8_t *buffer, size_t size);
+
+   // Statistics
+   struct Stats
+   {
+      unsigned long readCalls;  // read(2) system calls
+      unsigned long writeCalls; // write(2) system calls
+      unsigned long waits;      // epoll_wait/poll system calls
+   };
+   const Stats &stats() const { return counters; }
+   void resetStats();
+
+private:
+   int port;
+   int poller; // epoll descriptor, -1 if poll() is used
+   uint8_t buffer[256];
+   size_t head;
+   size_t tail;
+   Stats counters;
+
+   bool fill();
+};
+
+// Bind the library's serial calls straight to PosixSerial, including the wait
+template <> struct ISBDStreamAccess<PosixSerial>
+{
+   static int available(PosixSerial &s) { return s.PosixSerial::available(); }
+   static int read(PosixSerial &s) { return s.PosixSerial::read(); }
+   static size_t write(PosixSerial &s, uint8_t c) { return s.PosixSerial::write(c); }
+   static size_t write(PosixSerial &s, const uint8_t *data, size_t size) { return s.PosixSerial::write(data, size); }
+   static void print(PosixSerial &s, const char *str) { s.PosixSerial::write((const uint8_t *)str, strlen(str)); }
+   static void print(PosixSerial &s, FlashString str) { print(s, reinterpret_cast<const char *>(str)); }
+   static void waitForInput(PosixSerial &s, unsigned long ms) { s.waitForInput(ms); }
+};
+
+// IridiumSBD with every serial call, and its idle time, handled by PosixSerial
+typedef BasicIridiumSBD<PosixSerial, ISBDDefaultPolicy> PosixIridiumSBD;
+
+#endif
@@ -0,0 +1,469 @@
+/*
+SimulatedModem - A scriptable software stand-in for an Iridium 9602/9603 transceiver.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#include "SimulatedModem.h"
+
+SimulatedModem::SimulatedModem() :
+   mode(MODE_COMMAND),
+   binaryExpected(0),
+   echo(true),
+   profileEcho(true),
+   profileDefault(false),
+   bootTime(0),
+   readyAt(0),
+   baud(0),
+   hostBaud(0),
+   maxBaud(115200),
+   baudStuck(false),
+   latency(5),
+   sbdixLatency(100),
+   firmware("TA13001"),
+   csq(4),
+   network(true),
+   cier(false),
+   systemTime(0x5A3C1D00),
+   sbdwbResult(-1),
+   mtCorrupt(false),
+   mtRepeat(false),
+   moMSN(0),
+   mtMSN(0)
+{
+   resetStats();
+}
+
+void SimulatedModem::resetStats()
+{
+   memset(&counters, 0, sizeof(counters));
+}
+
+// The host clock, so hostAdvanceClock() brings pending output due along with everything else
+unsigned long long SimulatedModem::now() const
+{
+   return hostMicros();
+}
+
+// 10 bits per character on an 8N1 line
+unsigned long long SimulatedModem::byteTime() const
+{
+   return baud ? 10000000ULL / baud : 0;
+}
+
+int SimulatedModem::available()
+{
+   unsigned long long t = now();
+   int n = 0;
+   for (std::deque<Pending>::const_iterator it = output.begin(); it != output.end() && it->due <= t; ++it)
+      ++n;
+   return n;
+}
+
+int SimulatedModem::read()
+{
+   ++counters.readCalls;
+   if (output.empty() || output.front().due > now())
+      return -1;
+   uint8_t c = output.front().c;
+   output.pop_front();
+   ++counters.bytesToHost;
+   return c;
+}
+
+int SimulatedModem::peek()
+{
+   if (output.empty() || output.front().due > now())
+      return -1;
+   return output.front().c;
+}
+
+size_t SimulatedModem::write(uint8_t c)
+{
+   ++counters.writeCalls;
+   receive(c);
+   return 1;
+}
+
+size_t SimulatedModem::write(const uint8_t *buffer, size_t size)
+{
+   ++counters.writeCalls;
+   for (size_t i=0; i<size; ++i)
+      receive(buffer[i]);
+   return size;
+}
+
+void SimulatedModem::setBaudRate(unsigned long baud) { this->baud = hostBaud = baud; }
+void SimulatedModem::setHostBaudRate(unsigned long baud) { hostBaud = baud; }
+void SimulatedModem::setMaxBaudRate(unsigned long baud) { maxBaud = baud; }
+void SimulatedModem::setBaudRateStuck(bool stuck) { baudStuck = stuck; }
+void SimulatedModem::setResponseLatency(unsigned long ms) { latency = ms; }
+void SimulatedModem::setSBDIXLatency(unsigned long ms) { sbdixLatency = ms; }
+void SimulatedModem::setBootTime(unsigned long ms) { bootTime = ms; }
+
+// Everything volatile is lost; echo comes back from the stored profile if AT&Y0 selected it
+void SimulatedModem::powerCycle()
+{
+   output.clear();
+   line.clear();
+   mode = MODE_COMMAND;
+   cier = false;
+   echo = profileDefault ? profileEcho : true;
+   readyAt = now() + 1000ULL * bootTime;
+}
+
+void SimulatedModem::setFirmwareVersion(const char *version) { firmware = version; }
+
+void SimulatedModem::setSignalQuality(int bars)
+{
+   if (bars != csq)
+      indicate(0, bars);
+   csq = bars;
+}
+
+void SimulatedModem::setNetworkAvailable(bool available)
+{
+   if (available != network)
+      indicate(1, available);
+   network = available;
+}
+
+void SimulatedModem::setSystemTime(uint32_t ticks) { systemTime = ticks; }
+void SimulatedModem::queueSBDIXStatus(int moStatus) { sbdixStatus.push_back(moStatus); }
+void SimulatedModem::setSBDWBResult(int result) { sbdwbResult = result; }
+void SimulatedModem::failCommand(const char *prefix) { failures.push_back(prefix); }
+void SimulatedModem::corruptMTChecksum(bool corrupt) { mtCorrupt = corrupt; }
+
+void SimulatedModem::scriptResponse(const char *prefix, const std::string &response)
+{
+   scripted.push_back(std::make_pair(std::string(prefix), response));
+}
+
+void SimulatedModem::clearFailures()
+{
+   failures.clear();
+   scripted.clear();
+   sbdixStatus.clear();
+   sbdwbResult = -1;
+   mtCorrupt = false;
+}
+
+bool SimulatedModem::queueMTMessage(const uint8_t *data, size_t size)
+{
+   if (size > 270)
+      return false;
+   mtQueue.push_back(std::vector<uint8_t>(data, data + size));
+   return true;
+}
+
+// As the gateway does when it missed the acknowledgement of a delivery
+void SimulatedModem::repeatMTMessage()
+{
+   mtRepeat = true;
+}
+
+// +CIEV unsolicited indication, if enabled by AT+CIER
+void SimulatedModem::indicate(int indicator, int value)
+{
+   if (cier)
+   {
+      char buf[24];
+      snprintf(buf, sizeof(buf), "\r\n+CIEV:%d,%d\r\n", indicator, value);
+      emit(buf, 0);
+   }
+}
+
+void SimulatedModem::ring()
+{
+   emit("SBDRING\r\n", 0);
+}
+
+// Queue modem output; characters become readable after delayMs and then at the line rate
+void SimulatedModem::emit(const uint8_t *data, size_t size, unsigned long delayMs)
+{
+   unsigned long long due = now() + 1000ULL * delayMs;
+   if (!output.empty() && output.back().due > due)
+      due = output.back().due;
+   for (size_t i=0; i<size; ++i)
+   {
+      due += byteTime();
+      Pending p = { data[i], due };
+      output.push_back(p);
+   }
+}
+
+void SimulatedModem::receive(uint8_t c)
+{
+   ++counters.bytesFromHost;
+   if (now() < readyAt)
+      return; // still booting
+   if (hostBaud != baud)
+      return; // framing errors
+
+   switch (mode)
+   {
+   case MODE_SBDWB:
+      binary.push_back(c);
+      if (binary.size() == binaryExpected + 2)
+      {
+         uint16_t sum = 0;
+         for (size_t i=0; i<binaryExpected; ++i)
+            sum += binary[i];
+         uint16_t checksum = 256 * binary[binaryExpected] + binary[binaryExpected + 1];
+         int result = sbdwbResult >= 0 ? sbdwbResult : sum == checksum ? 0 : 2;
+         if (result == 0)
+            mo.assign(binary.begin(), binary.begin() + binaryExpected);
+         char buf[32];
+         snprintf(buf, sizeof(buf), "\r\n%d\r\n\r\nOK\r\n", result);
+         emit(buf, latency);
+         mode = MODE_COMMAND;
+      }
+      break;
+
+   case MODE_SBDWT:
+      if (c == '\r')
+      {
+         mo.assign(line.begin(), line.end());
+         line.clear();
+         emit("\r\n0\r\n\r\nOK\r\n", latency);
+         mode = MODE_COMMAND;
+      }
+      else
+      {
+         line += (char)c;
+      }
+      break;
+
+   default:
+      if (echo)
+         emit(&c, 1, 0);
+      if (c == '\r')
+      {
+         std::string cmd;
+         cmd.swap(line);
+         command(cmd);
+      }
+      else if (c != '\n')
+      {
+         line += (char)c;
+      }
+      break;
+   }
+}
+
+bool SimulatedModem::failing(const std::string &cmd) const
+{
+   for (size_t i=0; i<failures.size(); ++i)
+      if (cmd.compare(0, failures[i].size(), failures[i]) == 0)
+         return true;
+   return false;
+}
+
+// Answer cmd with the first scripted response meant for it, if any
+bool SimulatedModem::playScript(const std::string &cmd)
+{
+   for (size_t i=0; i<scripted.size(); ++i)
+      if (cmd.compare(0, scripted[i].first.size(), scripted[i].first) == 0)
+      {
+         emit(scripted[i].second, latency);
+         scripted.erase(scripted.begin() + i);
+         return true;
+      }
+   return false;
+}
+
+void SimulatedModem::command(const std::string &cmd)
+{
+   if (cmd.empty())
+      return;
+
+   ++counters.commands;
+   if (playScript(cmd))
+      return;
+
+   char buf[64];
+   if (failing(cmd))
+   {
+      emit("\r\nERROR\r\n", latency);
+   }
+   else if (cmd == "AT" || cmd == "AT&D0" || cmd == "AT&K0" || cmd.compare(0, 9, "AT+SBDMTA") == 0)
+   {
+      emit("\r\nOK\r\n", latency);
+   }
+   else if (cmd == "AT+SBDD0" || cmd == "AT+SBDD1" || cmd == "AT+SBDD2")
+   {
+      if (cmd[7] != '1')
+         mo.clear();
+      if (cmd[7] != '0')
+         mt.clear();
+      emit("\r\n0\r\n\r\nOK\r\n", latency);
+   }
+   else if (cmd == "AT&W0")
+   {
+      profileEcho = echo;
+      emit("\r\nOK\r\n", latency);
+   }
+   else if (cmd == "AT&Y0")
+   {
+      profileDefault = true;
+      emit("\r\nOK\r\n", latency);
+   }
+   else if (cmd == "ATE0" || cmd == "ATE1")
+   {
+      echo = cmd[3] == '1';
+      emit("\r\nOK\r\n", latency);
+   }
+   else if (cmd.compare(0, 8, "AT+CIER=") == 0)
+   {
+      cier = cmd.compare(8, 7, "1,1,1") == 0;
+      emit("\r\nOK\r\n", latency);
+      indicate(0, csq);
+      indicate(1, network);
+   }
+   else if (cmd.compare(0, 7, "AT+IPR=") == 0)
+   {
+      static const unsigned long rates[9] = { 600, 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+      int code = atoi(cmd.c_str() + 7);
+      if (code < 1 || code > 9 || rates[code - 1] > maxBaud)
+      {
+         emit("\r\nERROR\r\n", latency);
+      }
+      else
+      {
+         emit("\r\nOK\r\n", latency); // sent at the old rate
+         if (!baudStuck)
+            baud = rates[code - 1];
+      }
+   }
+   else if (cmd == "AT+CGMR")
+   {
+      emit("\r\nCall Processor Version: " + firmware + "\r\n"
+         "Modem DSP Version: 1.7 svn: 2358\r\n"
+         "DBB Version: 0x0001 (ASIC)\r\n"
+         "RFA VersionSRFA2 (SRFA2)\r\n"
+         "NVM Version: KVS\r\n"
+         "Hardware Version: BOOT07d2/9603NrevB/04/RAW0d\r\n"
+         "BOOT Version: " + firmware + "\r\n\r\nOK\r\n", latency);
+   }
+   else if (cmd == "AT-MSSTM")
+   {
+      ++counters.msstmQueries;
+      if (network)
+         snprintf(buf, sizeof(buf), "\r\n-MSSTM: %08x\r\n\r\nOK\r\n", (unsigned)systemTime);
+      else
+         snprintf(buf, sizeof(buf), "\r\n-MSSTM: no network service\r\n\r\nOK\r\n");
+      emit(buf, latency);
+   }
+   else if (cmd == "AT+CSQ")
+   {
+      snprintf(buf, sizeof(buf), "\r\n+CSQ:%d\r\n\r\nOK\r\n", csq);
+      emit(buf, latency);
+   }
+   else if (cmd.compare(0, 9, "AT+SBDWB=") == 0)
+   {
+      long size = atol(cmd.c_str() + 9);
+      if (size < 1 || size > 340)
+      {
+         emit("\r\n3\r\n\r\nOK\r\n", latency);
+      }
+      else
+      {
+         binaryExpected = (size_t)size;
+         binary.clear();
+         mode = MODE_SBDWB;
+         emit("\r\nREADY\r\n", latency);
+      }
+   }
+   else if (cmd == "AT+SBDWT")
+   {
+      mode = MODE_SBDWT;
+      emit("\r\nREADY\r\n", latency);
+   }
+   else if (cmd.compare(0, 9, "AT+SBDWT=") == 0)
+   {
+      mo.assign(cmd.begin() + 9, cmd.end());
+      emit("\r\nOK\r\n", latency);
+   }
+   else if (cmd == "AT+SBDIX" || cmd == "AT+SBDIXA")
+   {
+      sbdix();
+   }
+   else if (cmd == "AT+SBDRB")
+   {
+      sbdrb();
+   }
+   else
+   {
+      emit("\r\nERROR\r\n", latency);
+   }
+}
+
+void SimulatedModem::sbdix()
+{
+   ++counters.sbdixAttempts;
+
+   int moStatus = 0;
+   if (!sbdixStatus.empty())
+   {
+      moStatus = sbdixStatus.front();
+      sbdixStatus.pop_front();
+   }
+   else if (!network || csq == 0)
+   {
+      moStatus = 32; // no network service
+   }
+
+   int mtStatus = 0;
+   size_t mtLength = 0;
+   if (moStatus <= 4)
+   {
+      ++moMSN;
+      sent.push_back(mo);
+      if (mtRepeat && mtMSN != 0)
+      {
+         mtRepeat = false;
+         mtStatus = 1;
+         mtLength = mt.size();
+      }
+      else if (!mtQueue.empty())
+      {
+         mt = mtQueue.front();
+         mtQueue.pop_front();
+         mtStatus = 1;
+         mtLength = mt.size();
+         ++mtMSN;
+      }
+   }
+   else
+   {
+      mtStatus = 2;
+   }
+
+   char buf[64];
+   snprintf(buf, sizeof(buf), "\r\n+SBDIX: %d, %u, %d, %u, %u, %u\r\n\r\nOK\r\n",
+      moStatus, moMSN, mtStatus, mtMSN, (unsigned)mtLength, (unsigned)mtQueue.size());
+   emit(buf, sbdixLatency);
+}
+
+// Binary MT read: size[2], body[size], checksum[2], then OK
+void SimulatedModem::sbdrb()
+{
+   std::vector<uint8_t> out;
+   uint16_t sum = 0;
+   out.push_back(mt.size() >> 8);
+   out.push_back(mt.size() & 0xFF);
+   for (size_t i=0; i<mt.size(); ++i)
+   {
+      out.push_back(mt[i]);
+      sum += mt[i];
+   }
+   if (mtCorrupt)
+      sum ^= 0x5A5A;
+   out.push_back(sum >> 8);
+   out.push_back(sum & 0xFF);
+   emit(&out[0], out.size(), latency);
+   emit("\r\nOK\r\n", 0);
+}
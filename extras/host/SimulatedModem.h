@@ -0,0 +1,137 @@
+/*
+SimulatedModem - A scriptable software stand-in for an Iridium 9602/9603 transceiver.
+It speaks the subset of the AT dialect that IridiumSBD uses so the library can be
+exercised and timed on a host machine without hardware or airtime.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+*/
+
+#ifndef SIMULATED_MODEM_H
+#define SIMULATED_MODEM_H
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Arduino.h"
+
+class SimulatedModem : public Stream
+{
+public:
+   SimulatedModem();
+
+   // Stream interface (host side of the serial line)
+   int available();
+   int read();
+   int peek();
+   size_t write(uint8_t c);
+   size_t write(const uint8_t *buffer, size_t size);
+
+   // Link characteristics
+   void setBaudRate(unsigned long baud);          // paces modem output; 0 = unlimited
+   void setHostBaudRate(unsigned long baud);      // host port rate; input is lost while it differs
+   void setMaxBaudRate(unsigned long baud);       // AT+IPR above this answers ERROR
+   void setBaudRateStuck(bool stuck);             // AT+IPR answers OK but the modem stays at its rate
+   unsigned long baudRate() const { return baud; }
+   void setResponseLatency(unsigned long ms);     // delay before ordinary AT responses
+   void setSBDIXLatency(unsigned long ms);        // delay before +SBDIX responses
+   void setBootTime(unsigned long ms);            // input ignored for this long after powerCycle()
+   void powerCycle();                             // restart, restoring the power-up profile
+
+   // Modem state
+   void setFirmwareVersion(const char *version);  // e.g. "TA13001"
+   void setSignalQuality(int bars);               // 0-5, reported by +CSQ
+   void setNetworkAvailable(bool available);      // false makes -MSSTM report "no network service"
+   void setSystemTime(uint32_t ticks);            // 90 ms Iridium ticks reported by -MSSTM
+
+   // Failure injection
+   void queueSBDIXStatus(int moStatus);           // consumed one per +SBDIX; 0 when the queue is empty
+   void setSBDWBResult(int result);               // force the +SBDWB result code (-1 = compute it)
+   void failCommand(const char *prefix);          // commands starting with prefix answer ERROR
+   void corruptMTChecksum(bool corrupt);          // +SBDRB sends a wrong checksum
+   void scriptResponse(const char *prefix, const std::string &response); // the next command starting with prefix gets response verbatim
+   void clearFailures();
+
+   // Traffic
+   bool queueMTMessage(const uint8_t *data, size_t size);
+   void repeatMTMessage();                        // the next +SBDIX delivers the last MT message again, same MTMSN
+   void ring();                                   // emit an unsolicited SBDRING
+   const std::vector<uint8_t> &moBuffer() const { return mo; }
+   const std::vector<std::vector<uint8_t> > &sentMessages() const { return sent; }
+
+   // Statistics
+   struct Stats
+   {
+      unsigned long bytesFromHost;
+      unsigned long bytesToHost;
+      unsigned long writeCalls;
+      unsigned long readCalls;
+      unsigned long commands;
+      unsigned long sbdixAttempts;
+      unsigned long msstmQueries;
+   };
+   const Stats &stats() const { return counters; }
+   void resetStats();
+
+private:
+   enum { MODE_COMMAND, MODE_SBDWB, MODE_SBDWT };
+
+   struct Pending
+   {
+      uint8_t c;
+      unsigned long long due; // micros
+   };
+
+   std::deque<Pending> output;
+   std::string line;
+   std::vector<uint8_t> binary;
+   std::vector<uint8_t> mo;
+   std::vector<uint8_t> mt;
+   std::deque<std::vector<uint8_t> > mtQueue;
+   std::vector<std::vector<uint8_t> > sent;
+   std::deque<int> sbdixStatus;
+   std::vector<std::string> failures;
+   std::deque<std::pair<std::string, std::string> > scripted;
+
+   int mode;
+   size_t binaryExpected;
+   bool echo;
+   bool profileEcho;     // stored by AT&W0
+   bool profileDefault;  // AT&Y0 selected the stored profile at power-up
+   unsigned long bootTime;
+   unsigned long long readyAt;
+   unsigned long baud;
+   unsigned long hostBaud;
+   unsigned long maxBaud;
+   bool baudStuck;
+   unsigned long latency;
+   unsigned long sbdixLatency;
+   std::string firmware;
+   int csq;
+   bool network;
+   bool cier;
+   uint32_t systemTime;
+   int sbdwbResult;
+   bool mtCorrupt;
+   bool mtRepeat;
+   uint16_t moMSN;
+   uint16_t mtMSN;
+   Stats counters;
+
+   unsigned long long now() const;
+   unsigned long long byteTime() const;
+   void emit(const uint8_t *data, size_t size, unsigned long delayMs);
+   void emit(const std::string &s, unsigned long delayMs) { emit((const uint8_t *)s.data(), s.size(), delayMs); }
+   void receive(uint8_t c);
+   void command(const std::string &cmd);
+   bool failing(const std::string &cmd) const;
+   bool playScript(const std::string &cmd);
+   void sbdix();
+   void indicate(int indicator, int value);
+   void sbdrb();
+};
+
+#endif
@@ -0,0 +1,373 @@
+/*
+IridiumSBD - An Arduino library for Iridium SBD ("Short Burst Data") Communications
+Suggested and generously supported by Rock Seven Location Technology
+(http://rock7mobile.com), makers of the brilliant RockBLOCK satellite modem.
+Copyright (C) 2013-2017 Mikal Hart
+All rights reserved.
+
+The latest version of this library is available at http://arduiniana.org.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "IridiumSBD.h"
+
+/*
+Layout.  Each page starts with a magic byte and a 32-bit sequence number, one higher for
+each page opened, so the newest page can be found after a reset.  The sequence number is
+written before the magic byte, so a page is only recognized once its header is complete.
+Records follow back to back:
+
+   state, size (2), priority, CRC-16 (2), payload
+
+The state byte only ever loses bits: FF (free) -> FE (being written) -> FC (waiting to be
+sent) -> F8 (acknowledged).  A reset part way through an append leaves FE, which is
+skipped; anything unrecognizable ends the page, which is then no longer appended to.
+*/
+
+#define JOURNAL_PAGE_MAGIC   0x4A
+#define RECORD_FREE          0xFF
+#define RECORD_WRITING       0xFE
+#define RECORD_WAITING       0xFC
+#define RECORD_ACKED         0xF8
+
+// Bit at a time to keep it small
+uint16_t ISBDCRC16(uint16_t crc, const uint8_t *data, size_t size)
+{
+   while (size--)
+   {
+      crc ^= (uint16_t)*data++ << 8;
+      for (int i=0; i<8; ++i)
+         crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+   }
+   return crc;
+}
+
+int ISBDJournal::begin()
+{
+   ready = false;
+   claimed = 0;
+   pending = 0;
+   if (storage.pageCount < 2 || storage.pageSize < PAGE_HEADER + RECORD_HEADER + 1)
+      return ISBD_STORAGE_ERROR;
+
+   // The newest page is the one to append to
+   bool found = false;
+   for (uint16_t page=0; page<storage.pageCount; ++page)
+   {
+      uint32_t sequence;
+      if (pageSequence(page, sequence) && (!found || (int32_t)(sequence - headSequence) > 0))
+      {
+         found = true;
+         headPage = page;
+         headSequence = sequence;
+      }
+   }
+
+   if (!found) // blank storage
+   {
+      headSequence = 0;
+      if (!openPage(0))
+         return ISBD_STORAGE_ERROR;
+   }
+   else
+   {
+      // Find the end of the newest page
+      uint32_t offset = PAGE_HEADER;
+      uint8_t state, priority;
+      uint16_t size;
+      int ret;
+      while ((ret = recordAt(headPage, offset, state, size, priority)) > 0)
+         offset += RECORD_HEADER + size;
+      headOffset = ret == 0 ? offset : storage.pageSize; // never append after damage
+   }
+
+   // Count the messages still waiting, from the oldest page on
+   tailPage = (headPage + 1) % storage.pageCount;
+   tailOffset = PAGE_HEADER;
+   rescan();
+   ready = true;
+   return ISBD_SUCCESS;
+}
+
+int ISBDJournal::add(const uint8_t *data, size_t size, uint8_t priority)
+{
+   if (!ready)
+      return ISBD_STORAGE_ERROR;
+   if (size == 0)
+      return ISBD_MSG_EMPTY;
+   if (size > ISBD_MAX_MESSAGE_LENGTH || PAGE_HEADER + RECORD_HEADER + size > storage.pageSize)
+      return ISBD_MSG_TOO_LONG;
+
+   if (headOffset + RECORD_HEADER + size > storage.pageSize)
+   {
+      // The next page is the oldest, and can be reused unless the tail is still in it
+      uint16_t page = (headPage + 1) % storage.pageCount;
+      settleTail();
+      if (pending > 0 && tailPage == page)
+         return ISBD_QUEUE_FULL;
+      if (!openPage(page))
+         return ISBD_STORAGE_ERROR;
+   }
+
+   uint32_t record = address(headPage, headOffset);
+   uint16_t crc = ISBDCRC16(0xFFFF, data, size);
+   uint8_t header[RECORD_HEADER] = { RECORD_WRITING, (uint8_t)(size >> 8), (uint8_t)(size & 0xFF), priority,
+      (uint8_t)(crc >> 8), (uint8_t)(crc & 0xFF) };
+
+   // Claim the space first, so that from here on an interruption leaves a record to skip
+   headOffset += RECORD_HEADER + size;
+   if (!storage.write(storage.context, record, header, 1)
+      || !storage.write(storage.context, record + 1, header + 1, RECORD_HEADER - 1)
+      || !storage.write(storage.context, record + RECORD_HEADER, data, size)
+      || !setState(record, RECORD_WAITING))
+   {
+      headOffset = storage.pageSize;
+      return ISBD_STORAGE_ERROR;
+   }
+
+   if (pending++ == 0 || priority > topPriority)
+   {
+      topPriority = priority;
+      topCount = 1;
+   }
+   else if (priority == topPriority)
+   {
+      ++topCount;
+   }
+   return ISBD_SUCCESS;
+}
+
+// The oldest message of the highest priority waiting.  Searching stops at the first one
+// found, so a backlog of one priority is sent without rereading the records behind it.
+bool ISBDJournal::next(ISBDSegment &message)
+{
+   if (!ready || claimed)
+      return false;
+
+   while (pending > 0)
+   {
+      settleTail();
+      uint16_t page = tailPage, size = 0;
+      uint32_t offset = tailOffset;
+      uint8_t priority = 0;
+      bool found = false;
+      while (nextWaiting(page, offset, size, priority))
+      {
+         if (priority == topPriority)
+         {
+            found = true;
+            break;
+         }
+         offset += RECORD_HEADER + size;
+      }
+
+      if (!found) // the counts have drifted from storage; take them afresh
+      {
+         size_t before = pending;
+         rescan();
+         if (pending == before)
+            return false;
+         continue;
+      }
+
+      // A record whose payload has decayed is retired rather than sent
+      uint32_t record = address(page, offset);
+      if (!intact(record, size))
+      {
+         if (!retire(record, priority))
+            return false;
+         continue;
+      }
+
+      claimed = record;
+      claimedSize = size;
+      claimedPriority = priority;
+      message.data = storage.map ? storage.map(storage.context, record + RECORD_HEADER) : NULL;
+      message.size = size;
+      return true;
+   }
+   return false;
+}
+
+size_t ISBDJournal::read(size_t offset, uint8_t *buffer, size_t size)
+{
+   if (!claimed || offset >= claimedSize)
+      return 0;
+   if (size > claimedSize - offset)
+      size = claimedSize - offset;
+   return storage.read(storage.context, claimed + RECORD_HEADER + offset, buffer, size) ? size : 0;
+}
+
+void ISBDJournal::complete(bool sent)
+{
+   if (!claimed)
+      return;
+   uint32_t record = claimed;
+   claimed = 0;
+   if (sent)
+      retire(record, claimedPriority);
+}
+
+bool ISBDJournal::pageSequence(uint16_t page, uint32_t &sequence)
+{
+   uint8_t header[PAGE_HEADER];
+   if (!storage.read(storage.context, address(page, 0), header, sizeof(header)) || header[0] != JOURNAL_PAGE_MAGIC)
+      return false;
+   sequence = (uint32_t)header[1] << 24 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 8 | header[4];
+   return true;
+}
+
+// Decode the record header at offset.  Returns 1 for a record, 0 at the clean end of the
+// page's records, -1 if what is there can't be a record.
+int ISBDJournal::recordAt(uint16_t page, uint32_t offset, uint8_t &state, uint16_t &size, uint8_t &priority)
+{
+   uint8_t header[RECORD_HEADER];
+   if (offset + RECORD_HEADER > storage.pageSize)
+      return 0;
+   if (!storage.read(storage.context, address(page, offset), header, sizeof(header)))
+      return -1;
+
+   state = header[0];
+   if (state == RECORD_FREE)
+      return 0;
+   size = (uint16_t)(header[1] << 8 | header[2]);
+   priority = header[3];
+   if ((state != RECORD_WRITING && state != RECORD_WAITING && state != RECORD_ACKED)
+      || size > ISBD_MAX_MESSAGE_LENGTH || offset + RECORD_HEADER + size > storage.pageSize)
+      return -1;
+   return 1;
+}
+
+bool ISBDJournal::setState(uint32_t record, uint8_t state)
+{
+   return storage.write(storage.context, record, &state, 1);
+}
+
+// Erase page and make it the head
+bool ISBDJournal::openPage(uint16_t page)
+{
+   uint32_t sequence = headSequence + 1;
+   uint8_t header[PAGE_HEADER] = { JOURNAL_PAGE_MAGIC, (uint8_t)(sequence >> 24), (uint8_t)(sequence >> 16),
+      (uint8_t)(sequence >> 8), (uint8_t)sequence };
+   if (!storage.erase(storage.context, page)
+      || !storage.write(storage.context, address(page, 1), header + 1, PAGE_HEADER - 1)
+      || !storage.write(storage.context, address(page, 0), header, 1))
+      return false;
+
+   headPage = page;
+   headOffset = PAGE_HEADER;
+   headSequence = sequence;
+   return true;
+}
+
+// Find the first waiting record at or after page/offset, up to the head.  Pages that were
+// never opened, and whatever follows damage in a page, are passed over.
+bool ISBDJournal::nextWaiting(uint16_t &page, uint32_t &offset, uint16_t &size, uint8_t &priority)
+{
+   for (;;)
+   {
+      uint32_t sequence;
+      uint8_t state;
+      if (offset > PAGE_HEADER || pageSequence(page, sequence))
+      {
+         while (recordAt(page, offset, state, size, priority) > 0)
+         {
+            if (state == RECORD_WAITING)
+               return true;
+            offset += RECORD_HEADER + size;
+         }
+      }
+
+      if (page == headPage)
+         return false;
+      page = (page + 1) % storage.pageCount;
+      offset = PAGE_HEADER;
+   }
+}
+
+// Move the tail up to the oldest waiting message, or to the head if there is none.  The
+// tail only moves forwards, so this costs one read per record over the journal's life.
+void ISBDJournal::settleTail()
+{
+   uint16_t page = tailPage, size;
+   uint32_t offset = tailOffset;
+   uint8_t priority;
+   if (nextWaiting(page, offset, size, priority))
+   {
+      tailPage = page;
+      tailOffset = offset;
+   }
+   else
+   {
+      tailPage = headPage;
+      tailOffset = headOffset;
+   }
+}
+
+// Count the waiting messages and find the highest priority among them
+void ISBDJournal::rescan()
+{
+   settleTail();
+   pending = topCount = 0;
+   topPriority = 0;
+
+   uint16_t page = tailPage, size;
+   uint32_t offset = tailOffset;
+   uint8_t priority;
+   while (nextWaiting(page, offset, size, priority))
+   {
+      if (pending++ == 0 || priority > topPriority)
+      {
+         topPriority = priority;
+         topCount = 1;
+      }
+      else if (priority == topPriority)
+      {
+         ++topCount;
+      }
+      offset += RECORD_HEADER + size;
+   }
+}
+
+// Mark a waiting record acknowledged.  When the last message of the top priority goes, the
+// next priority down is found with one pass over what is still waiting.
+bool ISBDJournal::retire(uint32_t record, uint8_t priority)
+{
+   if (!setState(record, RECORD_ACKED))
+      return false;
+   --pending;
+   if (priority == topPriority && --topCount == 0 && pending > 0)
+      rescan();
+   return true;
+}
+
+bool ISBDJournal::intact(uint32_t record, uint16_t size)
+{
+   uint8_t buffer[32];
+   if (!storage.read(storage.context, record + 4, buffer, 2))
+      return false;
+   uint16_t expected = (uint16_t)(buffer[0] << 8 | buffer[1]), crc = 0xFFFF;
+
+   for (uint16_t done = 0; done < size;)
+   {
+      size_t n = (size_t)(size - done) < sizeof(buffer) ? size - done : sizeof(buffer);
+      if (!storage.read(storage.context, record + RECORD_HEADER + done, buffer, n))
+         return false;
+      crc = ISBDCRC16(crc, buffer, n);
+      done += n;
+   }
+   return crc == expected;
+}
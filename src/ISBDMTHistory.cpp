@@ -0,0 +1,134 @@
+/*
+IridiumSBD - An Arduino library for Iridium SBD ("Short Burst Data") Communications
+Suggested and generously supported by Rock Seven Location Technology
+(http://rock7mobile.com), makers of the brilliant RockBLOCK satellite modem.
+Copyright (C) 2013-2017 Mikal Hart
+All rights reserved.
+
+The latest version of this library is available at http://arduiniana.org.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include "IridiumSBD.h"
+
+// A saved history is one image: magic byte, 32-bit sequence number, count, index of the
+// oldest entry, the MTMSNs and a CRC-16 over everything before it.  Images go to pages 0
+// and 1 in turn, so a reset while one is being written leaves the other intact.
+
+#define HISTORY_MAGIC 0x48
+
+int ISBDMTHistory::begin()
+{
+   clear();
+   if (!persistent)
+      return ISBD_SUCCESS;
+   if (storage.pageCount < 2 || storage.pageSize < IMAGE_SIZE)
+      return ISBD_STORAGE_ERROR;
+
+   // Take the newer of the two images
+   int newest = -1;
+   uint32_t newestSequence = 0;
+   for (uint16_t page=0; page<2; ++page)
+   {
+      uint32_t imageSequence;
+      if (load(page, imageSequence) && (newest < 0 || (int32_t)(imageSequence - newestSequence) > 0))
+      {
+         newest = page;
+         newestSequence = imageSequence;
+      }
+   }
+   if (newest == 0) // page 1 was loaded last
+      load(0, newestSequence);
+   return ISBD_SUCCESS;
+}
+
+bool ISBDMTHistory::seen(uint16_t mtMSN) const
+{
+   for (uint8_t i=0; i<used; ++i)
+      if (msn[i] == mtMSN)
+         return true;
+   return false;
+}
+
+int ISBDMTHistory::record(uint16_t mtMSN)
+{
+   if (seen(mtMSN))
+      return ISBD_SUCCESS;
+
+   // Once full, the newest replaces the oldest
+   if (used < ISBD_MT_HISTORY_SIZE)
+   {
+      msn[used++] = mtMSN;
+   }
+   else
+   {
+      msn[oldest] = mtMSN;
+      oldest = (oldest + 1) % ISBD_MT_HISTORY_SIZE;
+   }
+   return !persistent || save() ? ISBD_SUCCESS : ISBD_STORAGE_ERROR;
+}
+
+void ISBDMTHistory::clear()
+{
+   used = oldest = 0;
+}
+
+// Read the image in page into the history if it is whole
+bool ISBDMTHistory::load(uint16_t page, uint32_t &imageSequence)
+{
+   uint8_t image[IMAGE_SIZE];
+   if (!storage.read(storage.context, (uint32_t)page * storage.pageSize, image, sizeof(image))
+      || image[0] != HISTORY_MAGIC || image[5] > ISBD_MT_HISTORY_SIZE || image[6] >= ISBD_MT_HISTORY_SIZE)
+      return false;
+   uint16_t crc = ISBDCRC16(0xFFFF, image, IMAGE_SIZE - 2);
+   if (image[IMAGE_SIZE - 2] != (crc >> 8) || image[IMAGE_SIZE - 1] != (crc & 0xFF))
+      return false;
+
+   imageSequence = (uint32_t)image[1] << 24 | (uint32_t)image[2] << 16 | (uint32_t)image[3] << 8 | image[4];
+   sequence = imageSequence;
+   used = image[5];
+   oldest = image[6];
+   for (uint8_t i=0; i<ISBD_MT_HISTORY_SIZE; ++i)
+      msn[i] = (uint16_t)(image[7 + 2 * i] << 8 | image[8 + 2 * i]);
+   return true;
+}
+
+bool ISBDMTHistory::save()
+{
+   uint32_t next = sequence + 1;
+   uint8_t image[IMAGE_SIZE];
+   image[0] = HISTORY_MAGIC;
+   for (int i=0; i<4; ++i)
+      image[1 + i] = next >> (24 - 8 * i);
+   image[5] = used;
+   image[6] = oldest;
+   for (uint8_t i=0; i<ISBD_MT_HISTORY_SIZE; ++i)
+   {
+      image[7 + 2 * i] = msn[i] >> 8;
+      image[8 + 2 * i] = msn[i] & 0xFF;
+   }
+   uint16_t crc = ISBDCRC16(0xFFFF, image, IMAGE_SIZE - 2);
+   image[IMAGE_SIZE - 2] = crc >> 8;
+   image[IMAGE_SIZE - 1] = crc & 0xFF;
+
+   uint16_t page = next % 2;
+   if (!storage.erase(storage.context, page)
+      || !storage.write(storage.context, (uint32_t)page * storage.pageSize, image, sizeof(image)))
+      return false;
+   sequence = next;
+   return true;
+}
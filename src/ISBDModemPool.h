@@ -0,0 +1,242 @@
+/*
+ISBDModemPool - Spreads a queue of outbound messages across several IridiumSBD modems
+driven side by side with the non-blocking session API.
+Copyright (C) 2013-2017 Mikal Hart
+All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef ISBD_MODEM_POOL_H
+#define ISBD_MODEM_POOL_H
+
+#include "IridiumSBD.h"
+
+#define ISBD_POOL_MAX_TRIES       3  // sessions a message gets, on any modem, before it is reported failed
+#define ISBD_POOL_SIGNAL_WEIGHT   16 // score per bar of signal, against a success rate of 0-255
+#define ISBD_POOL_RETRY_INTERVAL  20 // seconds before a failed message is tried again, doubling with each try
+
+// Reports the final result of a submitted message (ISBD_SUCCESS or the last session's error)
+typedef void (*ISBDPoolHook)(void *context, void *tag, int result);
+
+// Modem is IridiumSBD or another BasicIridiumSBD instantiation.  Modems are added already
+// begun; the pool only starts and polls sessions on them, so the application can still use
+// each modem's setCallback()/setDiagsOutput() hooks to tell them apart.
+template <class Modem = IridiumSBD, uint8_t MaxModems = 4, uint8_t QueueSize = 16>
+class ISBDModemPool
+{
+public:
+   ISBDModemPool(ISBDPoolHook hook = NULL, void *context = NULL) :
+      hook(hook),
+      context(context),
+      modemCount(0),
+      queueHead(0),
+      queueCount(0)
+   { }
+
+   // Add a modem that has been through begin().  Returns false if the pool is full.
+   bool addModem(Modem &modem)
+   {
+      if (modemCount == MaxModems)
+         return false;
+      Slot &slot = slots[modemCount++];
+      slot.modem = &modem;
+      slot.busy = false;
+      slot.refused = false;
+      slot.successRate = 128;
+      return true;
+   }
+
+   // Queue a binary message.  data must remain valid until the hook reports on it.
+   bool submit(const uint8_t *data, size_t size, void *tag = NULL)
+   {
+      if (queueCount == QueueSize)
+         return false;
+      Job &job = queue[(queueHead + queueCount++) % QueueSize];
+      job.data = data;
+      job.size = size;
+      job.tag = tag;
+      job.tries = 0;
+      job.failedAt = 0;
+      return true;
+   }
+
+   // Advance every modem's session, then hand queued messages to the best idle modems.
+   // Call as often as possible.
+   void poll()
+   {
+      for (uint8_t i=0; i<modemCount; ++i)
+      {
+         Slot &slot = slots[i];
+         slot.refused = false;
+         if (!slot.busy)
+            continue;
+         int ret = slot.modem->poll();
+         if (ret != ISBD_BUSY)
+            finish(slot, ret);
+      }
+
+      while (queueCount > 0)
+      {
+         uint8_t next = nextReady();
+         if (next == queueCount)
+            break;
+         Slot *slot = bestIdle();
+         if (slot == NULL)
+            break;
+         start(*slot, take(next));
+      }
+   }
+
+   size_t pending() const // queued or in flight
+   {
+      size_t n = queueCount;
+      for (uint8_t i=0; i<modemCount; ++i)
+         n += slots[i].busy;
+      return n;
+   }
+
+   uint8_t size() const { return modemCount; }
+   uint8_t successRate(uint8_t modem) const { return slots[modem].successRate; } // 0-255, recent sessions weigh most
+
+private:
+   struct Job
+   {
+      const uint8_t *data;
+      size_t size;
+      void *tag;
+      uint8_t tries;
+      unsigned long failedAt; // millis() of the last failed session, if tries > 0
+   };
+
+   struct Slot
+   {
+      Modem *modem;
+      Job job;
+      bool busy;
+      bool refused; // turned a job down during this poll()
+      uint8_t successRate;
+   };
+
+   ISBDPoolHook hook;
+   void *context;
+   Slot slots[MaxModems];
+   uint8_t modemCount;
+   Job queue[QueueSize];
+   uint8_t queueHead;
+   uint8_t queueCount;
+
+   // +CIEV is current; without +CIER the last +CSQ the application asked for is the best guess
+   int score(Slot &slot)
+   {
+      int bars = slot.modem->getSignalIndication();
+      if (bars < 0)
+         bars = slot.modem->getLastSignalQuality();
+      return slot.successRate + ISBD_POOL_SIGNAL_WEIGHT * (bars < 0 ? ISBD_DEFAULT_MINIMUM_SIGNAL : bars);
+   }
+
+   // Position in the queue of the first job whose retry interval has passed, or queueCount
+   uint8_t nextReady()
+   {
+      for (uint8_t i=0; i<queueCount; ++i)
+      {
+         const Job &job = queue[(queueHead + i) % QueueSize];
+         if (job.tries == 0 || millis() - job.failedAt >= (1000UL * ISBD_POOL_RETRY_INTERVAL) << (job.tries - 1))
+            return i;
+      }
+      return queueCount;
+   }
+
+   // Remove the job at position i; those ahead of it close the gap and keep their order
+   Job take(uint8_t i)
+   {
+      Job job = queue[(queueHead + i) % QueueSize];
+      for (; i>0; --i)
+         queue[(queueHead + i) % QueueSize] = queue[(queueHead + i - 1) % QueueSize];
+      queueHead = (queueHead + 1) % QueueSize;
+      --queueCount;
+      return job;
+   }
+
+   // The idle modem with the best recent success rate and signal, or NULL if none is free
+   Slot *bestIdle()
+   {
+      Slot *best = NULL;
+      int bestScore = -1;
+      for (uint8_t i=0; i<modemCount; ++i)
+      {
+         Slot &slot = slots[i];
+         if (slot.busy || slot.refused || slot.modem->isAsleep() || slot.modem->isBusy())
+            continue;
+         int s = score(slot);
+         if (s > bestScore)
+         {
+            best = &slot;
+            bestScore = s;
+         }
+      }
+      return best;
+   }
+
+   void start(Slot &slot, const Job &job)
+   {
+      int ret = slot.modem->startSendSBDBinary(job.data, job.size);
+      if (ret == ISBD_REENTRANT || ret == ISBD_IS_ASLEEP || ret == ISBD_BUSY)
+      {
+         // Turned down without a session: the job keeps its tries and its place, and
+         // this modem sits out the rest of the poll()
+         slot.refused = true;
+         requeue(job);
+         return;
+      }
+
+      slot.job = job;
+      ++slot.job.tries;
+      if (ret == ISBD_SUCCESS)
+         slot.busy = true;
+      else
+         finish(slot, ret);
+   }
+
+   void requeue(const Job &job)
+   {
+      queueHead = (queueHead + QueueSize - 1) % QueueSize;
+      queue[queueHead] = job;
+      ++queueCount;
+   }
+
+   void finish(Slot &slot, int ret)
+   {
+      slot.busy = false;
+      if (ret == ISBD_SUCCESS)
+         slot.successRate += (255 - slot.successRate) >> 2;
+      else
+         slot.successRate -= slot.successRate >> 2;
+
+      // Give a failed message another chance, ahead of the rest, on whichever modem is best
+      // once its retry interval has passed
+      if (ret != ISBD_SUCCESS && ret != ISBD_MSG_TOO_LONG && slot.job.tries < ISBD_POOL_MAX_TRIES && queueCount < QueueSize)
+      {
+         slot.job.failedAt = millis();
+         requeue(slot.job);
+         return;
+      }
+
+      if (hook)
+         hook(context, slot.job.tag, ret);
+   }
+};
+
+#endif
@@ -0,0 +1,188 @@
+/*
+IridiumSBD - An Arduino library for Iridium SBD ("Short Burst Data") Communications
+Suggested and generously supported by Rock Seven Location Technology
+(http://rock7mobile.com), makers of the brilliant RockBLOCK satellite modem.
+Copyright (C) 2013-2017 Mikal Hart
+All rights reserved.
+
+The latest version of this library is available at http://arduiniana.org.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "IridiumSBD.h"
+
+// Each message is an 11-byte header (size, priority, time queued, time to live; stored
+// byte by byte so the arena needs no alignment) followed by its payload, in the order the
+// messages were added.
+
+ISBDOutbox::ISBDOutbox(uint8_t *arena, size_t arenaSize) :
+   arena(arena),
+   arenaSize(arenaSize),
+   used(0),
+   messages(0),
+   claimed(-1),
+   discarded(0)
+{
+}
+
+int ISBDOutbox::add(const uint8_t *data, size_t size, uint8_t priority, unsigned long ttlSeconds)
+{
+   if (size == 0)
+      return ISBD_MSG_EMPTY;
+   if (size > ISBD_MAX_MESSAGE_LENGTH)
+      return ISBD_MSG_TOO_LONG;
+
+   purge();
+   while (used + headerSize + size > arenaSize)
+      if (!evictBelow(priority))
+         return ISBD_QUEUE_FULL;
+
+   uint8_t *p = arena + used;
+   uint32_t queued = millis(), ttl = 1000UL * ttlSeconds;
+   p[0] = size >> 8;
+   p[1] = size & 0xFF;
+   p[2] = priority;
+   for (int i=0; i<4; ++i)
+   {
+      p[3 + i] = queued >> (24 - 8 * i);
+      p[7 + i] = ttl >> (24 - 8 * i);
+   }
+   memcpy(p + headerSize, data, size);
+   used += headerSize + size;
+   ++messages;
+   return ISBD_SUCCESS;
+}
+
+void ISBDOutbox::clear()
+{
+   if (claimed >= 0)
+      return;
+   used = messages = 0;
+}
+
+bool ISBDOutbox::next(ISBDSegment &message)
+{
+   if (claimed >= 0)
+      return false;
+
+   purge();
+   long best = -1;
+   int bestPriority = -1;
+   for (size_t offset = 0; offset < used;)
+   {
+      Header h = header(offset);
+      if (h.priority > bestPriority) // strictly greater, so the oldest of equals wins
+      {
+         best = offset;
+         bestPriority = h.priority;
+      }
+      offset += headerSize + h.size;
+   }
+   if (best < 0)
+      return false;
+
+   claimed = best;
+   message.data = arena + best + headerSize;
+   message.size = header(best).size;
+   return true;
+}
+
+void ISBDOutbox::complete(bool sent)
+{
+   if (claimed < 0)
+      return;
+   size_t offset = claimed;
+   claimed = -1;
+   if (sent)
+      remove(offset);
+}
+
+ISBDOutbox::Header ISBDOutbox::header(size_t offset) const
+{
+   const uint8_t *p = arena + offset;
+   Header h;
+   h.size = (uint16_t)(p[0] << 8 | p[1]);
+   h.priority = p[2];
+   h.queued = h.ttl = 0;
+   for (int i=0; i<4; ++i)
+   {
+      h.queued = h.queued << 8 | p[3 + i];
+      h.ttl = h.ttl << 8 | p[7 + i];
+   }
+   return h;
+}
+
+// Offset of the first message that may be removed: the claimed one, and any before it,
+// must not move while the library is sending it
+size_t ISBDOutbox::movable() const
+{
+   return claimed < 0 ? 0 : claimed + headerSize + header(claimed).size;
+}
+
+bool ISBDOutbox::expired(const Header &h) const
+{
+   return h.ttl != 0 && (uint32_t)millis() - h.queued >= h.ttl;
+}
+
+// Close the gap left by the message at offset
+void ISBDOutbox::remove(size_t offset)
+{
+   size_t length = headerSize + header(offset).size;
+   memmove(arena + offset, arena + offset + length, used - offset - length);
+   used -= length;
+   --messages;
+}
+
+// Drop messages whose time to live has passed
+void ISBDOutbox::purge()
+{
+   for (size_t offset = movable(); offset < used;)
+   {
+      Header h = header(offset);
+      if (expired(h))
+      {
+         remove(offset);
+         ++discarded;
+      }
+      else
+      {
+         offset += headerSize + h.size;
+      }
+   }
+}
+
+// Make room by dropping the oldest of the lowest-priority messages, if below priority
+bool ISBDOutbox::evictBelow(uint8_t priority)
+{
+   long victim = -1;
+   int lowest = priority;
+   for (size_t offset = movable(); offset < used;)
+   {
+      Header h = header(offset);
+      if (h.priority < lowest)
+      {
+         victim = offset;
+         lowest = h.priority;
+      }
+      offset += headerSize + h.size;
+   }
+   if (victim < 0)
+      return false;
+
+   remove(victim);
+   ++discarded;
+   return true;
+}
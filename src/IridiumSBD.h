@@ -22,6 +22,9 @@ License along with this library; if not, write to the Free Software
 Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#ifndef IRIDIUM_SBD_H
+#define IRIDIUM_SBD_H
+
 #include <WString.h> // for FlashString
 #include <Stream.h> // for Stream
 #include "Arduino.h"
@@ -34,7 +37,112 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define ISBD_DEFAULT_SENDRECEIVE_TIME   300
 #define ISBD_STARTUP_MAX_TIME           240
 #define ISBD_MAX_MESSAGE_LENGTH         340
+#define ISBD_MAX_MT_MESSAGE_LENGTH      270
 #define ISBD_MSSTM_WORKAROUND_FW_VER    13001
+#define ISBD_IRIDIUM_EPOCH              1399818235UL // May 11, 2014, at 14:23:55 UTC
+#define ISBD_MSSTM_CACHE_TIME           600
+#define ISBD_MSSTM_DRIFT_MIN_TIME       300
+#define ISBD_MSSTM_DRIFT_MAX_TIME       86400
+#define ISBD_MSSTM_MAX_DRIFT_PPM        20000L
+#define ISBD_DEFAULT_MINIMUM_SIGNAL     2
+#define ISBD_CIER_MAX_BACKOFF_FACTOR    8
+#define ISBD_WAKE_PROBE_MIN_TIME        50   // ms
+#define ISBD_WAKE_PROBE_MAX_TIME        1000 // ms
+#define ISBD_DEFAULT_BAUD_RATE          19200
+#define ISBD_BAUD_SETTLE_TIME           100  // ms
+#define ISBD_BAUD_PROBES                3
+
+// Most bytes written to the modem in one bulk write (and in one poll() step)
+#ifndef ISBD_POLL_WRITE_CHUNK
+#if defined(ARDUINO_ARCH_AVR)
+#define ISBD_POLL_WRITE_CHUNK           16
+#else
+#define ISBD_POLL_WRITE_CHUNK           64
+#endif
+#endif
+
+// Longest the library sleeps in a port's waitForInput() before checking timeouts and
+// running the client callback again
+#define ISBD_IDLE_WAIT                  250  // ms
+
+// Size of the library's own receive buffer, which absorbs +SBDRB bursts while the
+// client's ISBDCallback runs.  Define before including IridiumSBD.h to override.
+#ifndef ISBD_RX_BUFFER_SIZE
+#if defined(ARDUINO_ARCH_AVR)
+#define ISBD_RX_BUFFER_SIZE             64
+#else
+#define ISBD_RX_BUFFER_SIZE             512
+#endif
+#endif
+
+// MTMSNs remembered by ISBDMTHistory.  Define before including IridiumSBD.h to override.
+#ifndef ISBD_MT_HISTORY_SIZE
+#if defined(ARDUINO_ARCH_AVR)
+#define ISBD_MT_HISTORY_SIZE            8
+#else
+#define ISBD_MT_HISTORY_SIZE            32
+#endif
+#endif
+
+// Trace record levels.  Records above the policy's traceLevel are compiled out.
+#define ISBD_TRACE_NONE                 0
+#define ISBD_TRACE_ERROR                1
+#define ISBD_TRACE_WARNING              2
+#define ISBD_TRACE_INFO                 3
+#define ISBD_TRACE_DEBUG                4
+
+// Most detailed level ISBDDefaultPolicy records.  Define before including IridiumSBD.h to override.
+#ifndef ISBD_TRACE_LEVEL
+#define ISBD_TRACE_LEVEL                ISBD_TRACE_INFO
+#endif
+
+// Trace records ISBDDefaultPolicy holds while a response line is still arriving.  With 0,
+// as on AVR where each record held costs 22 bytes of SRAM, records go to the sink at once.
+#ifndef ISBD_TRACE_QUEUE_SIZE
+#if defined(ARDUINO_ARCH_AVR)
+#define ISBD_TRACE_QUEUE_SIZE           0
+#else
+#define ISBD_TRACE_QUEUE_SIZE           16
+#endif
+#endif
+
+// Trace events, with the meaning of their arguments
+#define ISBD_EVENT_POWER          1 // on (1) or off (0)
+#define ISBD_EVENT_READY          2 // ms from power-on, 1 if the stored profile was used
+#define ISBD_EVENT_NO_MODEM       3
+#define ISBD_EVENT_FIRMWARE       4 // firmware number (e.g. 13001) or -1, MSSTM workaround on
+#define ISBD_EVENT_MO_WRITE       5 // +SBDWB/+SBDWT result, payload size
+#define ISBD_EVENT_SBDIX          6 // MO status, MOMSN, MT status, MTMSN
+#define ISBD_EVENT_SBDIX_RETRY    7 // MO status, seconds until the next attempt
+#define ISBD_EVENT_MSSTM          8 // system time ticks, or -1 if not yet valid
+#define ISBD_EVENT_SESSION_TIMEOUT 9 // seconds allowed
+#define ISBD_EVENT_MT_RECEIVED    10 // size, MTMSN
+#define ISBD_EVENT_MT_CHECKSUM    11 // received checksum, computed checksum
+#define ISBD_EVENT_RING           12 // 0 = RING pin, 1 = SBDRING
+#define ISBD_EVENT_INDICATION     13 // +CIEV indicator, value
+#define ISBD_EVENT_BAUD_RATE      14 // requested rate, result code
+#define ISBD_EVENT_RX_OVERRUN     15 // total overruns
+#define ISBD_EVENT_FINAL_RESULT   16 // unexpected final result: 0 = OK, 1 = ERROR
+#define ISBD_EVENT_CLOCK_DRIFT    17 // millis() drift against Iridium time, ppm
+#define ISBD_EVENT_MT_DUPLICATE   18 // MTMSN of an MT message already delivered, left unread
+#define ISBD_EVENT_MT_HISTORY     19 // MTMSN that couldn't be saved to the MT history
+
+// Command classes timed by ISBDMetrics
+#define ISBD_COMMAND_OTHER        0 // AT, profile and configuration commands
+#define ISBD_COMMAND_SBDW         1 // +SBDWB/+SBDWT/+SBDD, until READY or OK
+#define ISBD_COMMAND_SBDIX        2
+#define ISBD_COMMAND_SBDRB        3 // until the last byte of the MT message
+#define ISBD_COMMAND_MSSTM        4
+#define ISBD_COMMAND_CSQ          5
+#define ISBD_COMMAND_CGMR         6
+#define ISBD_COMMAND_IPR          7
+#define ISBD_COMMAND_COUNT        8
+
+// Latency histogram buckets end at 50, 100, 250, 500, 1000, 2500, 5000, 10000 and 30000 ms;
+// the last bucket takes anything slower
+#define ISBD_LATENCY_BUCKETS      10
+#define ISBD_MO_STATUS_SLOTS      40 // MO status codes 0-38; the last slot counts anything higher
+#define ISBD_ATTEMPT_SLOTS        8  // sessions by +SBDIX attempts made; the last slot is 7 or more
 
 #define ISBD_SUCCESS             0
 #define ISBD_ALREADY_AWAKE       1
@@ -50,10 +158,328 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #define ISBD_NO_SLEEP_PIN        11
 #define ISBD_NO_NETWORK          12
 #define ISBD_MSG_TOO_LONG        13
+#define ISBD_BUSY                14
+#define ISBD_CHECKSUM_ERROR      15
+#define ISBD_UNSUPPORTED_BAUD    16
+#define ISBD_QUEUE_FULL          17
+#define ISBD_QUEUE_EMPTY         18
+#define ISBD_STORAGE_ERROR       19
+#define ISBD_MSG_EMPTY           20
 
 typedef const __FlashStringHelper *FlashString;
 
-class IridiumSBD
+// One piece of a scatter-gather (MO) binary message
+struct ISBDSegment
+{
+   const uint8_t *data;
+   size_t size;
+};
+
+// Receives an incoming (MT) message in pieces as it arrives from the modem.  The 16-bit
+// checksum can only be verified after the last piece, so a client writing straight to
+// flash or actuators should discard what it received if the call returns ISBD_CHECKSUM_ERROR.
+typedef void (*ISBDReceiveSink)(void *context, const uint8_t *data, size_t size);
+
+// Receives each complete, checksum-verified message retrieved by drainMailbox, with its MT MSN
+typedef void (*ISBDMailboxSink)(void *context, uint16_t mtMSN, const uint8_t *data, size_t size);
+
+// Counters kept in application memory once passed to setMetrics().  Counts stop at their
+// maximum rather than wrapping; zero the struct to start afresh.
+struct ISBDMetrics
+{
+   uint16_t latency[ISBD_COMMAND_COUNT][ISBD_LATENCY_BUCKETS]; // response times by command
+   uint16_t timeouts[ISBD_COMMAND_COUNT];     // commands that got no response in time
+   uint16_t sessions;                         // completed send/receive sessions and mailbox drains
+   uint16_t attempts[ISBD_ATTEMPT_SLOTS];     // sessions by number of +SBDIX attempts
+   uint32_t sbdixAttempts;
+   uint16_t moStatus[ISBD_MO_STATUS_SLOTS];   // +SBDIX MO status codes
+   uint16_t mtStatus[3];                      // +SBDIX MT status: none, received, error
+   uint16_t msstmNotReady;                    // -MSSTM answers of "no network service"
+   uint32_t awakeTime;                        // ms the modem has been powered
+   uint32_t bytesOut;                         // bytes written to the modem
+   uint32_t bytesIn;                          // bytes read from the modem
+   uint16_t mtDuplicates;                     // MT messages left unread as already delivered
+};
+
+// Outbox priorities.  Any value 0-255 may be used; higher goes first.
+#define ISBD_PRIORITY_ROUTINE     0
+#define ISBD_PRIORITY_ALARM       200
+
+// Where sendQueued() takes messages from: an ISBDOutbox in RAM or an ISBDJournal in
+// persistent storage.  The library claims the message to send next, reads it, and reports
+// whether it went; nothing else may remove it meanwhile.
+class ISBDQueue
+{
+public:
+   // Claim the next message.  message.data is NULL if it isn't in addressable memory and
+   // must be fetched piecemeal with read().
+   virtual bool next(ISBDSegment &message) = 0;
+   virtual size_t read(size_t offset, uint8_t *buffer, size_t size) { return 0; } // of the claimed message
+   virtual void complete(bool sent) = 0;
+
+protected:
+   ~ISBDQueue() { }
+};
+
+// Prioritized outbound messages stored back to back in an arena supplied by the
+// application; no heap is used.  The library sends straight out of the arena.  A message
+// leaves the outbox when it has been sent, or unsent once its time to live has passed, or
+// when a message of higher priority needs its room.
+class ISBDOutbox : public ISBDQueue
+{
+public:
+   ISBDOutbox(uint8_t *arena, size_t arenaSize);
+
+   // ttlSeconds = 0 keeps the message until it is sent.  An empty message is refused, as
+   // a session would take it for a mailbox check.
+   int add(const uint8_t *data, size_t size, uint8_t priority = ISBD_PRIORITY_ROUTINE, unsigned long ttlSeconds = 0);
+   size_t count() const { return messages; }
+   size_t bytesUsed() const { return used; }
+   unsigned long dropped() const { return discarded; } // expired or displaced before being sent
+   void clear();
+
+   // Used by the library: claim the message to send next (highest priority, then oldest),
+   // then report whether it went.  The claimed message stays put in the arena until then;
+   // only messages added after it may expire or be displaced meanwhile.
+   bool next(ISBDSegment &message);
+   void complete(bool sent);
+
+private:
+   struct Header
+   {
+      uint16_t size;
+      uint8_t priority;
+      uint32_t queued; // millis()
+      uint32_t ttl;    // ms, 0 = forever
+   };
+   static const size_t headerSize = 11;
+
+   uint8_t *arena;
+   size_t arenaSize;
+   size_t used;
+   size_t messages;
+   long claimed; // offset of the message being sent, -1 if none
+   unsigned long discarded;
+
+   Header header(size_t offset) const;
+   size_t movable() const;
+   bool expired(const Header &h) const;
+   void remove(size_t offset);
+   void purge();
+   bool evictBelow(uint8_t priority);
+};
+
+// Persistent storage divided into equal pages that are erased (to 0xFF) as a whole.
+// write() need only be able to clear bits of erased bytes, as in flash.  map() returns
+// storage that is directly addressable (memory-mapped flash or file), or is NULL.
+struct ISBDStorage
+{
+   size_t pageSize;
+   uint16_t pageCount;
+   bool (*read)(void *context, uint32_t address, uint8_t *data, size_t size);
+   bool (*write)(void *context, uint32_t address, const uint8_t *data, size_t size);
+   bool (*erase)(void *context, uint16_t page);
+   const uint8_t *(*map)(void *context, uint32_t address);
+   void *context;
+};
+
+// CRC-16/CCITT, used to check what is read back from persistent storage
+uint16_t ISBDCRC16(uint16_t crc, const uint8_t *data, size_t size);
+
+// Append-only store-and-forward journal of MO messages that survives resets.  Records are
+// appended to pages used in rotation, so wear is spread evenly; a message is marked
+// acknowledged in place once sent (MO status 0-4), and a page is reused only when none of
+// its messages are still waiting.  Each record moves through states by clearing bits of
+// one byte, so an interrupted write leaves a record that recovery recognizes and skips.
+class ISBDJournal : public ISBDQueue
+{
+public:
+   ISBDJournal(const ISBDStorage &storage) :
+      storage(storage), ready(false), headPage(0), headOffset(0), headSequence(0), tailPage(0), tailOffset(0),
+      claimed(0), claimedSize(0), claimedPriority(0), pending(0), topPriority(0), topCount(0) { }
+
+   int begin(); // recover after a reset, or format blank storage; reads each record header once
+   int add(const uint8_t *data, size_t size, uint8_t priority = ISBD_PRIORITY_ROUTINE); // ISBD_STORAGE_ERROR until begin() succeeds
+   size_t count() const { return pending; } // messages not yet acknowledged
+
+   bool next(ISBDSegment &message);
+   size_t read(size_t offset, uint8_t *buffer, size_t size);
+   void complete(bool sent);
+
+private:
+   enum { PAGE_HEADER = 5, RECORD_HEADER = 6 };
+   ISBDStorage storage;
+   bool ready;            // begin() succeeded
+   uint16_t headPage;     // page being appended to
+   uint32_t headOffset;   // where the next record goes in it
+   uint32_t headSequence; // page sequence numbers order the pages by age
+   uint16_t tailPage;     // no message before here is waiting
+   uint32_t tailOffset;
+   uint32_t claimed;      // address of the claimed record, 0 if none
+   size_t claimedSize;
+   uint8_t claimedPriority;
+   size_t pending;
+   uint8_t topPriority;   // highest priority among waiting messages,
+   size_t topCount;       // and how many have it
+
+   uint32_t address(uint16_t page, uint32_t offset) const { return (uint32_t)page * storage.pageSize + offset; }
+   bool pageSequence(uint16_t page, uint32_t &sequence);
+   int recordAt(uint16_t page, uint32_t offset, uint8_t &state, uint16_t &size, uint8_t &priority);
+   bool setState(uint32_t record, uint8_t state);
+   bool openPage(uint16_t page);
+   bool nextWaiting(uint16_t &page, uint32_t &offset, uint16_t &size, uint8_t &priority);
+   void settleTail();
+   void rescan();
+   bool retire(uint32_t record, uint8_t priority);
+   bool intact(uint32_t record, uint16_t size);
+};
+
+// The MTMSNs of recently delivered MT messages.  The gateway sends a message again, under
+// the same MTMSN, when it didn't hear that the first delivery arrived; with a history
+// attached (setMTHistory()) the library recognizes the repeat from +SBDIX and leaves it
+// unread.  Optionally kept in two ISBDStorage pages, written alternately, so the history
+// survives a reset.
+class ISBDMTHistory
+{
+public:
+   ISBDMTHistory() : persistent(false), sequence(0), used(0), oldest(0) { }
+   ISBDMTHistory(const ISBDStorage &storage) : storage(storage), persistent(true), sequence(0), used(0), oldest(0) { }
+
+   int begin(); // load the saved history, if persistent
+   bool seen(uint16_t mtMSN) const;
+   int record(uint16_t mtMSN); // ISBD_STORAGE_ERROR if it couldn't be saved
+   void clear();
+
+private:
+   enum { IMAGE_SIZE = 5 + 2 + 2 * ISBD_MT_HISTORY_SIZE + 2 };
+   ISBDStorage storage;
+   bool persistent;
+   uint32_t sequence; // of the last image saved
+   uint8_t used;
+   uint8_t oldest;
+   uint16_t msn[ISBD_MT_HISTORY_SIZE];
+
+   bool load(uint16_t page, uint32_t &imageSequence);
+   bool save();
+};
+
+// One structured diagnostic record
+struct ISBDTraceRecord
+{
+   unsigned long timestamp; // millis() when the event happened
+   uint8_t level;           // ISBD_TRACE_*
+   uint8_t event;           // ISBD_EVENT_*
+   long args[4];            // see ISBD_EVENT_*; unused arguments are 0
+};
+
+// Storage for trace records held back until the end of a line; none at all when Size is 0
+template <uint8_t Size> struct ISBDTraceQueue
+{
+   ISBDTraceRecord records[Size];
+   ISBDTraceRecord *at(uint8_t i) { return &records[i]; }
+};
+
+template <> struct ISBDTraceQueue<0>
+{
+   ISBDTraceRecord *at(uint8_t i) { return NULL; }
+};
+
+// Receives trace records, whole and in order, at line boundaries of the modem's output
+typedef void (*ISBDTraceSink)(void *context, const ISBDTraceRecord &record);
+
+// Reconfigures the host serial port to a new rate (e.g. by calling Serial3.begin(baud)).
+// Returns false if the port can't run at that rate.
+typedef bool (*ISBDBaudRateHook)(void *context, unsigned long baud);
+
+// Per-instance stand-in for ISBDCallback: return false to cancel the operation in progress
+typedef bool (*ISBDCallbackHook)(void *context);
+
+// Per-instance console or diagnostic output, one character at a time
+typedef void (*ISBDOutputHook)(void *context, char c);
+
+template <class StreamT, class Policy> class BasicIridiumSBD;
+struct ISBDDefaultPolicy;
+
+// The classic, fully featured driver over any Arduino Stream
+typedef BasicIridiumSBD<Stream, ISBDDefaultPolicy> IridiumSBD;
+
+// Client hooks: define these in your sketch to override the do-nothing defaults
+bool ISBDCallback();
+void ISBDConsoleCallback(IridiumSBD *device, char c);
+void ISBDDiagsCallback(IridiumSBD *device, char c);
+
+// Compile-time feature selection for BasicIridiumSBD.  Code behind a flag that is false is
+// never compiled in.  Derive a policy from this one to turn selected features back on,
+// supplying consoleOutput/diagsOutput if you enable console or diagnostics.
+struct ISBDMinimalPolicy
+{
+   static const bool console = false;         // AT traffic to consoleOutput()
+   static const bool diagnostics = false;     // library diagnostics to diagsOutput()
+   static const bool ringAlerts = false;      // RING pin, SBDRING and enableRingAlerts()
+   static const bool msstmWorkaround = false; // -MSSTM check before +SBDIX (Iridium Alert 5/7/13)
+   static const uint8_t traceLevel = ISBD_TRACE_NONE; // most detailed trace records kept
+   static const uint8_t traceQueueSize = 0;   // trace records held until the end of a line
+   static const bool metrics = false;         // ISBDMetrics support
+   template <class Device> static void consoleOutput(Device *device, char c) { }
+   template <class Device> static void diagsOutput(Device *device, char c) { }
+};
+
+// Everything on, with output going to the global ISBDConsoleCallback/ISBDDiagsCallback.
+// Other instantiations have no global callback; they use setConsoleOutput()/setDiagsOutput().
+struct ISBDDefaultPolicy
+{
+   static const bool console = true;
+   static const bool diagnostics = true;
+   static const bool ringAlerts = true;
+   static const bool msstmWorkaround = true;
+   static const uint8_t traceLevel = ISBD_TRACE_LEVEL;
+   static const uint8_t traceQueueSize = ISBD_TRACE_QUEUE_SIZE;
+   static const bool metrics = true;
+   static void consoleOutput(IridiumSBD *device, char c) { ISBDConsoleCallback(device, c); }
+   static void diagsOutput(IridiumSBD *device, char c) { ISBDDiagsCallback(device, c); }
+   template <class Device> static void consoleOutput(Device *device, char c) { }
+   template <class Device> static void diagsOutput(Device *device, char c) { }
+};
+
+// Serial port access.  For a concrete port type the calls are qualified, so they bind
+// directly to that type's functions instead of going through the Stream vtable.
+// waitForInput() may block until input arrives or ms pass; ports that can't do that
+// return at once and the library polls them instead.  Specialize this for a port
+// type that can (see extras/host/PosixSerial.h).
+template <class StreamT> struct ISBDStreamAccess
+{
+   static int available(StreamT &s) { return s.StreamT::available(); }
+   static int read(StreamT &s) { return s.StreamT::read(); }
+   static size_t write(StreamT &s, uint8_t c) { return s.StreamT::write(c); }
+   static size_t write(StreamT &s, const uint8_t *data, size_t size) { return s.StreamT::write(data, size); }
+   static void print(StreamT &s, const char *str) { s.StreamT::write((const uint8_t *)str, strlen(str)); }
+   static void print(StreamT &s, FlashString str)
+   {
+#if defined(ARDUINO_ARCH_AVR)
+      for (PGM_P p = reinterpret_cast<PGM_P>(str); pgm_read_byte(p); ++p)
+         s.StreamT::write((uint8_t)pgm_read_byte(p));
+#else
+      print(s, reinterpret_cast<const char *>(str)); // flash strings are ordinary strings here
+#endif
+   }
+   static void waitForInput(StreamT &s, unsigned long ms) { }
+};
+
+template <> struct ISBDStreamAccess<Stream>
+{
+   static int available(Stream &s) { return s.available(); }
+   static int read(Stream &s) { return s.read(); }
+   static size_t write(Stream &s, uint8_t c) { return s.write(c); }
+   static size_t write(Stream &s, const uint8_t *data, size_t size) { return s.write(data, size); }
+   static void print(Stream &s, FlashString str) { s.print(str); }
+   static void print(Stream &s, const char *str) { s.print(str); }
+   static void waitForInput(Stream &s, unsigned long ms) { }
+};
+
+// StreamT is the serial port type (HardwareSerial, SoftwareSerial, ...); Policy is
+// ISBDDefaultPolicy, ISBDMinimalPolicy or a policy derived from one of them.
+template <class StreamT, class Policy>
+class BasicIridiumSBD
 {
 public:
    int begin();
@@ -61,22 +487,65 @@ public:
    int sendSBDBinary(const uint8_t *txData, size_t txDataSize);
    int sendReceiveSBDText(const char *message, uint8_t *rxBuffer, size_t &rxBufferSize);
    int sendReceiveSBDBinary(const uint8_t *txData, size_t txDataSize, uint8_t *rxBuffer, size_t &rxBufferSize);
+   int sendSBDBinary(const ISBDSegment *segments, size_t segmentCount);
+   int sendReceiveSBDBinary(const ISBDSegment *segments, size_t segmentCount, uint8_t *rxBuffer, size_t &rxBufferSize);
+   int sendReceiveSBDText(const char *message, ISBDReceiveSink sink, void *context = NULL);
+   int sendReceiveSBDBinary(const uint8_t *txData, size_t txDataSize, ISBDReceiveSink sink, void *context = NULL);
+   int drainMailbox(uint8_t *rxBuffer, size_t rxBufferSize, ISBDMailboxSink sink, void *context = NULL, int maxMessages = 0);
    int getSignalQuality(int &quality);
    int getSystemTime(struct tm &tm);
+   int getSystemTimeEpoch(uint32_t &unixSeconds, uint16_t &ms);
+   static void epochToTM(uint32_t unixSeconds, struct tm &tm); // UTC fields, as gmtime() gives them
    int getFirmwareVersion(char *version, size_t bufferSize);
+   int negotiateBaudRate(unsigned long baud, ISBDBaudRateHook hook, void *context = NULL);
+   unsigned long getBaudRate();
    int getWaitingMessageCount();
+   unsigned long getRXOverrunCount();
+   unsigned long getWakeLatency();
    bool isAsleep();
    bool hasRingAsserted();
    int sleep();
 
+   // Non-blocking variants: start a session, then call poll() until it stops returning ISBD_BUSY.
+   // Buffers passed to the start functions must remain valid until the session completes.
+   int startSendSBDText(const char *message);
+   int startSendSBDBinary(const uint8_t *txData, size_t txDataSize);
+   int startSendReceiveSBDText(const char *message, uint8_t *rxBuffer, size_t &rxBufferSize);
+   int startSendReceiveSBDBinary(const uint8_t *txData, size_t txDataSize, uint8_t *rxBuffer, size_t &rxBufferSize);
+   int startSendSBDBinary(const ISBDSegment *segments, size_t segmentCount);
+   int startSendReceiveSBDBinary(const ISBDSegment *segments, size_t segmentCount, uint8_t *rxBuffer, size_t &rxBufferSize);
+   int startSendReceiveSBDText(const char *message, ISBDReceiveSink sink, void *context = NULL);
+   int startSendReceiveSBDBinary(const uint8_t *txData, size_t txDataSize, ISBDReceiveSink sink, void *context = NULL);
+   int startDrainMailbox(uint8_t *rxBuffer, size_t rxBufferSize, ISBDMailboxSink sink, void *context = NULL, int maxMessages = 0);
+   int poll();
+   bool isBusy();
+   void cancelSendReceive();
+
    typedef enum { DEFAULT_POWER_PROFILE = 0, USB_POWER_PROFILE = 1 } POWERPROFILE;
    void setPowerProfile(POWERPROFILE profile); // 0 = direct connect (default), 1 = USB
    void adjustATTimeout(int seconds);          // default value = 20 seconds
    void adjustSendReceiveTimeout(int seconds); // default value = 300 seconds
    void useMSSTMWorkaround(bool useMSSTMWorkAround); // true to use workaround from Iridium Alert 5/7/13
    void enableRingAlerts(bool enable);
+   void useSignalIndications(bool enable, int minimumBars = ISBD_DEFAULT_MINIMUM_SIGNAL); // retry SBDIX on +CIEV, applied at begin()
+   void useFastWake(bool enable);              // store config in the modem profile and skip redundant init after sleep
+   void useCommandEcho(bool enable);           // default true; false halves received bytes, applied at begin()
+   void setTraceSink(ISBDTraceSink sink, void *context = NULL); // NULL to stop tracing
+   void setMetrics(ISBDMetrics *metrics);      // counters accumulate into *metrics; NULL to stop
+   void snapshotMetrics(ISBDMetrics &snapshot); // copy, with awake time counted up to now
+   void setCallback(ISBDCallbackHook hook, void *context = NULL);     // NULL reverts to ISBDCallback
+   void setConsoleOutput(ISBDOutputHook hook, void *context = NULL); // NULL reverts to the policy's output
+   void setDiagsOutput(ISBDOutputHook hook, void *context = NULL);   // NULL reverts to the policy's output
+   int getSignalIndication();                  // bars from the latest +CIEV, -1 if unknown
+   int getLastSignalQuality();                 // bars from the latest getSignalQuality(), -1 if none since begin()
+   void setOutbox(ISBDQueue *outbox);          // an ISBDOutbox or ISBDJournal; NULL to detach
+   int sendQueued();                           // send from the outbox until it is empty or a session fails
+   int startSendQueued();                      // non-blocking: one session for the outbox's next message
+   void setMTHistory(ISBDMTHistory *history, bool autoRecord = true); // skip MT messages already delivered; NULL to detach
+   long getMOMSN();                            // MOMSN from the last session's +SBDIX, -1 if none
+   long getMTMSN();                            // MTMSN of the last session's MT message, -1 if none
 
-   IridiumSBD(Stream &str, int sleepPinNo = -1, int ringPinNo = -1) :
+   BasicIridiumSBD(StreamT &str, int sleepPinNo = -1, int ringPinNo = -1) :
       stream(str),
       sbdixInterval(ISBD_USB_SBDIX_INTERVAL),
       atTimeout(ISBD_DEFAULT_AT_TIMEOUT),
@@ -86,22 +555,67 @@ public:
       reentrant(false),
       sleepPin(sleepPinNo),
       ringPin(ringPinNo),
-      msstmWorkaroundRequested(true),
-      ringAlertsEnabled(ringPinNo != -1),
+      msstmWorkaroundRequested(Policy::msstmWorkaround),
+      ringAlertsEnabled(Policy::ringAlerts && ringPinNo != -1),
       ringAsserted(false),
+      signalIndicationsEnabled(false),
+      signalIndicationsActive(false),
+      minimumSignal(ISBD_DEFAULT_MINIMUM_SIGNAL),
+      signalIndication(-1),
+      serviceIndication(-1),
+      signalQuality(-1),
       lastPowerOnTime(0UL),
-      head(SBDRING),
-      tail(SBDRING),
-      nextChar(-1)
+      echoEnabled(true),
+      fastWakeEnabled(false),
+      profileSaved(false),
+      firmwareChecked(false),
+      wakeLatency(0UL),
+      baudRate(ISBD_DEFAULT_BAUD_RATE),
+      baudRateHook(NULL),
+      baudRateContext(NULL),
+      callbackHook(NULL),
+      callbackContext(NULL),
+      consoleHook(NULL),
+      consoleContext(NULL),
+      diagsHook(NULL),
+      diagsContext(NULL),
+      outbox(NULL),
+      sessionFromOutbox(false),
+      mtHistory(NULL),
+      mtAutoRecord(true),
+      lastMOMSN(-1L),
+      lastMTMSN(-1L),
+      traceSink(NULL),
+      traceContext(NULL),
+      traceCount(0),
+      metrics(NULL),
+      metricCommand(ISBD_COMMAND_COUNT),
+      metricStart(0),
+      sessionAttempts(0),
+      awakeSince(0),
+      msstmCacheValid(false),
+      msstmDriftPPM(0L),
+      rxHead(0),
+      rxCount(0),
+      rxOverruns(0UL),
+      rxBacklogged(false),
+      sessionState(SESSION_IDLE),
+      sessionResult(ISBD_SUCCESS),
+      urcLen(0),
+      urcOut(0),
+      urcHeld(false),
+      urcLineStart(true),
+      urcMatched(-1)
    {
       if (sleepPin != -1)
          pinMode(sleepPin, OUTPUT);
-      if (ringPin != -1)
+      if (Policy::ringAlerts && ringPin != -1)
          pinMode(ringPin, INPUT);
    }
 
 private:
-   Stream &stream; // Communicating with the Iridium
+   typedef ISBDStreamAccess<StreamT> Port;
+   StreamT &stream; // Communicating with the Iridium
 
    // Timings
    int sbdixInterval;
@@ -117,27 +631,219 @@ private:
    bool msstmWorkaroundRequested;
    bool ringAlertsEnabled;
    bool ringAsserted;
+   bool signalIndicationsEnabled;
+   bool signalIndicationsActive; // AT+CIER accepted at the last begin(), so +CIEV will arrive
+   int  minimumSignal;
+   int8_t signalIndication;  // from +CIEV, -1 if unknown
+   int8_t serviceIndication; // from +CIEV, -1 if unknown
+   int8_t signalQuality;     // from +CSQ, -1 if unknown
    unsigned long lastPowerOnTime;
+   bool echoEnabled;
+   bool fastWakeEnabled;
+   bool profileSaved;    // modem profile 0 holds E &D0 &K0 and is restored at power-up
+   bool firmwareChecked; // msstmWorkaroundRequested reflects the firmware version
+   unsigned long wakeLatency;
+
+   // Current line rate and the client's hook for reconfiguring the host port
+   static const uint32_t iprRates[9]; // AT+IPR codes 1-9, in flash
+   unsigned long baudRate;
+   ISBDBaudRateHook baudRateHook;
+   void *baudRateContext;
+
+   // Per-instance hooks, used in place of the global callbacks when set
+   ISBDCallbackHook callbackHook;
+   void *callbackContext;
+   ISBDOutputHook consoleHook;
+   void *consoleContext;
+   ISBDOutputHook diagsHook;
+   void *diagsContext;
+   void consoleOutput(char c) { if (consoleHook) consoleHook(consoleContext, c); else Policy::consoleOutput(this, c); }
+   void diagsOutput(char c) { if (diagsHook) diagsHook(diagsContext, c); else Policy::diagsOutput(this, c); }
+
+   // Outbound queue; sessionFromOutbox is set while a session carries the outbox's claimed message
+   ISBDQueue *outbox;
+   bool sessionFromOutbox;
+   void outboxDone(int ret);
+   void recordMT();
+
+   // Delivered MT messages, and the message sequence numbers of the last session
+   ISBDMTHistory *mtHistory;
+   bool mtAutoRecord; // record each MTMSN once delivered, or leave it to the client
+   long lastMOMSN;
+   long lastMTMSN;
+   int internalNegotiateBaudRate(unsigned long baud, ISBDBaudRateHook hook, void *context);
+   int switchBaudRate(unsigned long baud);
+
+   // Structured trace.  The level test is against a compile-time constant, so records the
+   // policy excludes cost nothing.
+   ISBDTraceSink traceSink;
+   void *traceContext;
+   ISBDTraceQueue<Policy::traceLevel ? Policy::traceQueueSize : 0> traceQueue;
+   uint8_t traceCount;
+   void trace(uint8_t level, uint8_t event, long a0 = 0, long a1 = 0, long a2 = 0, long a3 = 0)
+   {
+      if (level <= Policy::traceLevel && traceSink)
+         queueTrace(level, event, a0, a1, a2, a3);
+   }
+   void queueTrace(uint8_t level, uint8_t event, long a0, long a1, long a2, long a3);
+   void flushTrace();
+   static const char *formatNumber(char *str, uint16_t n);
+
+   // Metrics.  metricCommand is the class of the command awaiting a response, or
+   // ISBD_COMMAND_COUNT if none is being timed.  The tables are in flash.
+   enum { COMMAND_PREFIX_COUNT = 8 };
+   static const uint16_t latencyBounds[ISBD_LATENCY_BUCKETS - 1];
+   static const char commandPrefixes[COMMAND_PREFIX_COUNT][7];
+   static const uint8_t commandClasses[COMMAND_PREFIX_COUNT];
+   ISBDMetrics *metrics;
+   uint8_t metricCommand;
+   unsigned long metricStart;
+   uint8_t sessionAttempts;
+   unsigned long awakeSince;
+   bool metering() { return Policy::metrics && metrics != NULL; }
+   void startCommandTimer(const char *command, bool flash);
+   void stopCommandTimer(bool answered);
+   void countSBDIX(uint16_t moCode, uint16_t mtCode);
+   void finishSession(int ret);
+   static void bump(uint16_t &counter) { if (counter != 0xFFFF) ++counter; }
+   static void bump(uint32_t &counter, uint32_t n = 1) { counter = n > 0xFFFFFFFFUL - counter ? 0xFFFFFFFFUL : counter + n; }
+
+   // Last valid -MSSTM reading, the millis() at which it arrived, and the measured
+   // rate error of millis() against Iridium time
+   bool msstmCacheValid;
+   uint32_t msstmCacheTicks;
+   unsigned long msstmCacheMillis;
+   long msstmDriftPPM;
+   void recordSystemTime(uint32_t ticks);
+   bool systemTimeFresh();
+   uint32_t driftCorrected(unsigned long elapsedMs);
+   static long driftMs(unsigned long seconds, long ppm);
+   uint32_t systemTicksSince(unsigned long elapsedMs);
+
+   // Library-owned receive ring, topped up from the stream at every opportunity
+   uint8_t rxRing[ISBD_RX_BUFFER_SIZE];
+   uint16_t rxHead;
+   uint16_t rxCount;
+   unsigned long rxOverruns;
+   bool rxBacklogged;
+   void drainSerial();
+   int rxAvailable();
+   int rxRead();
+   size_t rxContiguous(const uint8_t *&data);
+   void rxConsume(size_t n);
+
+   // Send/receive session state machine
+   enum
+   {
+      SESSION_IDLE, SESSION_WAIT_READY, SESSION_WRITE_PAYLOAD, SESSION_WAIT_WRITTEN,
+      SESSION_START_SBDIX, SESSION_WAIT_MSSTM, SESSION_WAIT_SBDIX, SESSION_RETRY_WAIT,
+      SESSION_WAIT_SBDRB_ECHO, SESSION_READ_SBDRB, SESSION_WAIT_SBDRB_OK
+   };
+   uint8_t sessionState;
+   int sessionResult;
+   const ISBDSegment *sessionSegments;
+   size_t sessionSegmentCount;
+   size_t sessionSegment;
+   ISBDSegment sessionSingle;
+   size_t sessionTxSize;
+   size_t sessionTxPos;
+   bool sessionTxText;
+   uint16_t sessionChecksum;
+   uint8_t *sessionRxBase;
+   uint8_t *sessionRxBuffer;
+   size_t *sessionRxBufferSize;
+   size_t sessionRxCapacity;
+   size_t sessionRxRoom;
+   bool sessionRxOverflow;
+   ISBDMailboxSink sessionMailboxSink;
+   void *sessionMailboxContext;
+   int sessionMailboxLeft; // -1 = no limit
+   uint16_t sessionMTMSN;
+   bool sessionSkipMSSTM;
+   bool sessionForceAttempt;
+   unsigned long sessionBackoff;
+   ISBDReceiveSink sessionSink;
+   void *sessionSinkContext;
+   uint16_t sbdrbSize;
+   uint16_t sbdrbPos;
+   uint16_t sbdrbSum;
+   unsigned long sessionStart;
+   unsigned long stateStart;
+   unsigned long stateDuration;
+   uint32_t sessionFields[6]; // decoded +SBDIX or -MSSTM response
+
+   // Incremental AT response matcher.  The caller's terminator is tracked in parallel with
+   // the final result codes in finalResults[] (in flash), so a response that ends some other
+   // way than expected is reported as soon as it arrives.
+   enum { LOOKING_FOR_PROMPT, GATHERING_RESPONSE, LOOKING_FOR_TERMINATOR };
+   enum { MATCH_PENDING, MATCH_TERMINATOR, MATCH_OK, MATCH_ERROR };
+   static const char finalResults[2][8];
+   const char *matchPrompt;
+   const char *matchTerminator;
+   char *matchResponse;
+   int matchResponseSize;
+   int matchPromptPos;
+   int matchTerminatorPos;
+   uint8_t matchFinalPos[2];
+   uint8_t matchState;
+   uint8_t matchLineLen;
+   char matchLineFirst;
+   bool matchAtLineStart;  // the last character was CR or LF, so a terminator or final result may begin
+   int8_t matchResultCode; // last single-digit result line (e.g. +SBDWB status), -1 if none
+
+   // Numeric fields decoded straight from the characters following the prompt, in place of
+   // copying them to a response buffer.  Fields are separated by commas (optionally followed
+   // by spaces); anything else, a missing field or a value above matchFieldMax invalidates
+   // the lot.
+   uint32_t *matchFields;
+   uint32_t matchFieldMax;
+   uint8_t matchFieldCount;
+   uint8_t matchFieldIndex;
+   uint8_t matchFieldDigits;
+   uint8_t matchFieldBase;
+   bool matchFieldError;
+   bool matchFieldsValid;
 
    // Internal utilities
-   bool noBlockWait(int seconds);
    bool waitForATResponse(char *response=NULL, int responseSize=0, const char *prompt=NULL, const char *terminator="OK\r\n");
+   void beginATResponse(char *response, int responseSize, const char *prompt, const char *terminator);
+   bool awaitATResponse(unsigned long timeoutMs);
+   bool endATResponse(bool matched);
+   bool waitForATFields(uint32_t *fields, uint8_t count, uint8_t base, uint32_t max, const char *prompt);
+   void beginATFields(uint32_t *fields, uint8_t count, uint8_t base, uint32_t max, const char *prompt);
+   void decodeField(char c);
+   bool probeModem(unsigned long timeoutMs);
+   int  matchATResponse(char c);
+   int  pollATResponse();
 
    int  internalBegin();
-   int  internalSendReceiveSBD(const char *txTxtMessage, const uint8_t *txData, size_t txDataSize, uint8_t *rxBuffer, size_t *prxBufferSize);
+   int  internalSendReceiveSBD(const char *txTxtMessage, const ISBDSegment *segments, size_t segmentCount, uint8_t *rxBuffer, size_t *prxBufferSize,
+      ISBDReceiveSink sink = NULL, void *sinkContext = NULL);
+   int  startSession(const char *txTxtMessage, const ISBDSegment *segments, size_t segmentCount, uint8_t *rxBuffer, size_t *prxBufferSize,
+      ISBDReceiveSink sink = NULL, void *sinkContext = NULL, bool loadMO = true);
+   int  startMailbox(uint8_t *rxBuffer, size_t rxBufferSize, ISBDMailboxSink sink, void *context, int maxMessages);
+   void beginSBDRB();
+   void receiveMT(const uint8_t *data, size_t size);
+   static uint16_t checksum(const uint8_t *data, size_t size);
+   int  stepSession();
+   void expectSession(uint8_t state, char *response, int responseSize, const char *prompt, const char *terminator);
+   void expectSessionFields(uint8_t state, uint8_t count, uint8_t base, uint32_t max, const char *prompt);
+   void waitSession(int seconds);
+   bool sessionExpired();
+   void idleSession();
+   bool idleFor(unsigned long ms);
+   bool linkUsable();
    int  internalGetSignalQuality(int &quality);
-   int  internalMSSTMWorkaround(bool &okToProceed);
    int  internalSleep();
 
-   int  doSBDIX(uint16_t &moCode, uint16_t &moMSN, uint16_t &mtCode, uint16_t &mtMSN, uint16_t &mtLen, uint16_t &mtRemaining);
-   int  doSBDRB(uint8_t *rxBuffer, size_t *prxBufferSize); // in/out
    void power(bool on);
 
    void send(FlashString str, bool beginLine = true, bool endLine = true);
    void send(const char *str);
    void send(uint16_t n);
 
-   bool cancelled(); // call ISBDCallback and see if client cancelled the operation
+   bool cancelled(); // call the client callback and see if it cancelled the operation
+   void checkRingPin();
 
    void diagprint(FlashString str);
    void diagprint(const char *str);
@@ -149,12 +855,26 @@ private:
    void consoleprint(char c);
    void SBDRINGSeen();
 
-   // Unsolicited SBDRING filter technology
-   static const char SBDRING[];
-   static const int FILTERTIMEOUT = 10;
-   const char *head, *tail;
-   int nextChar;
-   void filterSBDRING();
+   // Unsolicited result code filter technology.  Characters at the start of a line are held
+   // while they could still begin one of the codes in unsolicited[] (in flash); a complete
+   // code line is swallowed and dispatched, anything else is released to the response matcher.
+   enum { URC_SBDRING, URC_CIEV, URC_AREG, URC_COUNT };
+   static const char unsolicited[URC_COUNT][8];
+   char urcLine[24];
+   uint8_t urcLen;   // characters in urcLine
+   uint8_t urcOut;   // characters of urcLine already released
+   bool urcHeld;     // urcLine holds a possible unsolicited code
+   bool urcLineStart;
+   int8_t urcMatched; // index of the code being collected, -1 if none
+   void filterUnsolicited();
+   void unsolicitedSeen(int code, const char *params);
    int filteredavailable();
    int filteredread();
 };
+
+#include "IridiumSBDImpl.h"
+
+// Compiled once, in IridiumSBD.cpp
+extern template class BasicIridiumSBD<Stream, ISBDDefaultPolicy>;
+
+#endif
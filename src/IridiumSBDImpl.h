@@ -0,0 +1,2461 @@
+/*
+IridiumSBD - An Arduino library for Iridium SBD ("Short Burst Data") Communications
+Suggested and generously supported by Rock Seven Location Technology
+(http://rock7mobile.com), makers of the brilliant RockBLOCK satellite modem.
+Copyright (C) 2013-2017 Mikal Hart
+All rights reserved.
+
+The latest version of this library is available at http://arduiniana.org.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef IRIDIUM_SBD_IMPL_H
+#define IRIDIUM_SBD_IMPL_H
+
+// Member definitions of BasicIridiumSBD, included by IridiumSBD.h
+
+#include <time.h>
+
+// Power on the RockBLOCK or return from sleep
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::begin()
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = internalBegin();
+   this->reentrant = false;
+
+   // Absent a successful startup, keep the device turned off
+   if (ret != ISBD_SUCCESS)
+      power(false);
+
+   return ret;
+}
+
+// Transmit a binary message
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sendSBDBinary(const uint8_t *txData, size_t txDataSize)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   ISBDSegment segment = { txData, txDataSize };
+   int ret = internalSendReceiveSBD(NULL, &segment, 1, NULL, NULL);
+   this->reentrant = false;
+   return ret;
+}
+
+// Transmit queued messages, best first, until the outbox is empty or one fails
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sendQueued()
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = ISBD_QUEUE_EMPTY;
+   ISBDSegment message;
+   while (this->outbox && this->outbox->next(message))
+   {
+      sessionFromOutbox = true;
+      ret = internalSendReceiveSBD(NULL, &message, 1, NULL, NULL);
+      outboxDone(ret); // in case the session never started
+      if (ret != ISBD_SUCCESS)
+         break;
+   }
+   this->reentrant = false;
+   return ret;
+}
+
+// Transmit and receive a binary message
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sendReceiveSBDBinary(const uint8_t *txData, size_t txDataSize, uint8_t *rxBuffer, size_t &rxBufferSize)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   ISBDSegment segment = { txData, txDataSize };
+   int ret = internalSendReceiveSBD(NULL, &segment, 1, rxBuffer, &rxBufferSize);
+   this->reentrant = false;
+   return ret;
+}
+
+// Transmit a binary message and stream any reply to sink
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sendReceiveSBDBinary(const uint8_t *txData, size_t txDataSize, ISBDReceiveSink sink, void *context)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   ISBDSegment segment = { txData, txDataSize };
+   int ret = internalSendReceiveSBD(NULL, &segment, 1, NULL, NULL, sink, context);
+   this->reentrant = false;
+   return ret;
+}
+
+// Transmit a binary message gathered from several segments
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sendSBDBinary(const ISBDSegment *segments, size_t segmentCount)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = internalSendReceiveSBD(NULL, segments, segmentCount, NULL, NULL);
+   this->reentrant = false;
+   return ret;
+}
+
+// Transmit a binary message gathered from several segments and receive reply
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sendReceiveSBDBinary(const ISBDSegment *segments, size_t segmentCount, uint8_t *rxBuffer, size_t &rxBufferSize)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = internalSendReceiveSBD(NULL, segments, segmentCount, rxBuffer, &rxBufferSize);
+   this->reentrant = false;
+   return ret;
+}
+
+// Transmit a text message
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sendSBDText(const char *message)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = internalSendReceiveSBD(message, NULL, 0, NULL, NULL);
+   this->reentrant = false;
+   return ret;
+}
+
+// Transmit a text message and receive reply
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sendReceiveSBDText(const char *message, uint8_t *rxBuffer, size_t &rxBufferSize)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = internalSendReceiveSBD(message, NULL, 0, rxBuffer, &rxBufferSize);
+   this->reentrant = false;
+   return ret;
+}
+
+// Transmit a text message and stream any reply to sink
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sendReceiveSBDText(const char *message, ISBDReceiveSink sink, void *context)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = internalSendReceiveSBD(message, NULL, 0, NULL, NULL, sink, context);
+   this->reentrant = false;
+   return ret;
+}
+
+// Retrieve up to maxMessages (0 = all) waiting messages back-to-back, handing each to sink
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::drainMailbox(uint8_t *rxBuffer, size_t rxBufferSize, ISBDMailboxSink sink, void *context, int maxMessages)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = startMailbox(rxBuffer, rxBufferSize, sink, context, maxMessages);
+   if (ret == ISBD_SUCCESS)
+   {
+      while ((ret = stepSession()) == ISBD_BUSY)
+      {
+         if (cancelled())
+         {
+            ret = ISBD_CANCELLED;
+            break;
+         }
+         idleSession();
+      }
+      finishSession(ret);
+   }
+   this->reentrant = false;
+   return ret;
+}
+
+// High-level wrapper for AT+CSQ
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::getSignalQuality(int &quality)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = internalGetSignalQuality(quality);
+   this->reentrant = false;
+   return ret;
+}
+
+// Move the serial link to a faster rate with AT+IPR, falling back to the current rate on failure
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::negotiateBaudRate(unsigned long baud, ISBDBaudRateHook hook, void *context)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   this->reentrant = true;
+   int ret = internalNegotiateBaudRate(baud, hook, context);
+   trace(ISBD_TRACE_INFO, ISBD_EVENT_BAUD_RATE, (long)baud, ret);
+   this->reentrant = false;
+   return ret;
+}
+
+// Return the line rate last negotiated (ISBD_DEFAULT_BAUD_RATE after power-up)
+template <class StreamT, class Policy>
+unsigned long BasicIridiumSBD<StreamT, Policy>::getBaudRate()
+{
+   return this->baudRate;
+}
+
+// Gracefully put device to lower power mode (if sleep pin provided)
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::sleep()
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   if (this->sleepPin == -1)
+      return ISBD_NO_SLEEP_PIN;
+
+   this->reentrant = true;
+   int ret = internalSleep();
+   this->reentrant = false;
+
+   if (ret == ISBD_SUCCESS)
+      power(false); // power off
+   return ret;
+}
+
+// Return sleep state
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::isAsleep()
+{
+   return this->asleep;
+}
+
+// Return number of pending messages
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::getWaitingMessageCount()
+{
+   return this->remainingMessages;
+}
+
+// Return the number of times the receive ring filled up with serial data still waiting
+template <class StreamT, class Policy>
+unsigned long BasicIridiumSBD<StreamT, Policy>::getRXOverrunCount()
+{
+   return this->rxOverruns;
+}
+
+// Begin a non-blocking binary transmission
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSendSBDBinary(const uint8_t *txData, size_t txDataSize)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   ISBDSegment segment = { txData, txDataSize };
+   int ret = startSession(NULL, &segment, 1, NULL, NULL);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Begin a non-blocking binary transmission and reception
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSendReceiveSBDBinary(const uint8_t *txData, size_t txDataSize, uint8_t *rxBuffer, size_t &rxBufferSize)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   ISBDSegment segment = { txData, txDataSize };
+   int ret = startSession(NULL, &segment, 1, rxBuffer, &rxBufferSize);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Begin a non-blocking binary transmission, streaming any reply to sink
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSendReceiveSBDBinary(const uint8_t *txData, size_t txDataSize, ISBDReceiveSink sink, void *context)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   ISBDSegment segment = { txData, txDataSize };
+   int ret = startSession(NULL, &segment, 1, NULL, NULL, sink, context);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Begin a non-blocking transmission gathered from several segments
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSendSBDBinary(const ISBDSegment *segments, size_t segmentCount)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   int ret = startSession(NULL, segments, segmentCount, NULL, NULL);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Begin a non-blocking transmission of the outbox's next message
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSendQueued()
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   ISBDSegment message;
+   if (!this->outbox || !this->outbox->next(message))
+      return ISBD_QUEUE_EMPTY;
+
+   sessionFromOutbox = true;
+   int ret = startSession(NULL, &message, 1, NULL, NULL);
+   if (ret != ISBD_SUCCESS)
+      outboxDone(ret);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Begin a non-blocking transmission gathered from several segments, and reception
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSendReceiveSBDBinary(const ISBDSegment *segments, size_t segmentCount, uint8_t *rxBuffer, size_t &rxBufferSize)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   int ret = startSession(NULL, segments, segmentCount, rxBuffer, &rxBufferSize);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Begin a non-blocking text transmission
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSendSBDText(const char *message)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   int ret = startSession(message, NULL, 0, NULL, NULL);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Begin a non-blocking text transmission and reception
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSendReceiveSBDText(const char *message, uint8_t *rxBuffer, size_t &rxBufferSize)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   int ret = startSession(message, NULL, 0, rxBuffer, &rxBufferSize);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Begin a non-blocking text transmission, streaming any reply to sink
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSendReceiveSBDText(const char *message, ISBDReceiveSink sink, void *context)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   int ret = startSession(message, NULL, 0, NULL, NULL, sink, context);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Begin a non-blocking mailbox drain
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startDrainMailbox(uint8_t *rxBuffer, size_t rxBufferSize, ISBDMailboxSink sink, void *context, int maxMessages)
+{
+   if (this->reentrant)
+      return ISBD_REENTRANT;
+
+   int ret = startMailbox(rxBuffer, rxBufferSize, sink, context, maxMessages);
+   this->reentrant = ret == ISBD_SUCCESS;
+   return ret;
+}
+
+// Advance a session begun with one of the start* functions.  Returns ISBD_BUSY while
+// the session is in progress, otherwise the final result of the most recent session.
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::poll()
+{
+   if (this->sessionState == SESSION_IDLE)
+      return this->sessionResult;
+
+   int ret = stepSession();
+   if (ret != ISBD_BUSY)
+   {
+      finishSession(ret);
+      this->reentrant = false;
+   }
+   return ret;
+}
+
+// Return whether a non-blocking session is in progress
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::isBusy()
+{
+   return this->sessionState != SESSION_IDLE;
+}
+
+// Abandon a non-blocking session
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::cancelSendReceive()
+{
+   if (this->sessionState == SESSION_IDLE)
+      return;
+
+   diagprint(F("Session cancelled\r\n"));
+   finishSession(ISBD_CANCELLED);
+   this->reentrant = false;
+}
+
+// Define capacitor recharge times
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::setPowerProfile(POWERPROFILE profile) // 0 = direct connect (default), 1 = USB
+{
+   switch(profile)
+   {
+   case DEFAULT_POWER_PROFILE:
+      this->sbdixInterval = ISBD_DEFAULT_SBDIX_INTERVAL;
+      break;
+
+   case USB_POWER_PROFILE:
+      this->sbdixInterval = ISBD_USB_SBDIX_INTERVAL;
+      break;
+   }
+}
+
+// Tweak AT timeout 
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::adjustATTimeout(int seconds)
+{
+   this->atTimeout = seconds;
+}
+
+// Tweak Send/Receive SBDIX process timeout
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::adjustSendReceiveTimeout(int seconds)
+{
+   this->sendReceiveTimeout = seconds;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::useMSSTMWorkaround(bool useWorkAround) // true to use workaround from Iridium Alert 5/7 
+{
+   this->msstmWorkaroundRequested = Policy::msstmWorkaround && useWorkAround;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::useSignalIndications(bool enable, int minimumBars) // true to schedule SBDIX retries from +CIEV
+{
+   this->signalIndicationsEnabled = enable;
+   this->minimumSignal = minimumBars;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::useFastWake(bool enable) // true to keep configuration in the modem profile across sleep
+{
+   this->fastWakeEnabled = enable;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::setTraceSink(ISBDTraceSink sink, void *context)
+{
+   flushTrace();
+   this->traceSink = sink;
+   this->traceContext = context;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::setCallback(ISBDCallbackHook hook, void *context)
+{
+   this->callbackHook = hook;
+   this->callbackContext = context;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::setConsoleOutput(ISBDOutputHook hook, void *context)
+{
+   this->consoleHook = hook;
+   this->consoleContext = context;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::setDiagsOutput(ISBDOutputHook hook, void *context)
+{
+   this->diagsHook = hook;
+   this->diagsContext = context;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::setOutbox(ISBDQueue *outbox)
+{
+   this->outbox = outbox;
+}
+
+// With autoRecord false, the library only consults the history; the client calls
+// history.record(getMTMSN()) once it has acted on the message, so a reset part way through
+// leaves the message to be handled again when the gateway repeats it
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::setMTHistory(ISBDMTHistory *history, bool autoRecord)
+{
+   this->mtHistory = history;
+   this->mtAutoRecord = autoRecord;
+}
+
+// Note an MT message as delivered, once it has been handed over
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::recordMT()
+{
+   if (!mtHistory || !mtAutoRecord || mtHistory->record(sessionMTMSN) == ISBD_SUCCESS)
+      return;
+   diagprint(F("MT history not saved\r\n"));
+   trace(ISBD_TRACE_ERROR, ISBD_EVENT_MT_HISTORY, sessionMTMSN);
+}
+
+template <class StreamT, class Policy>
+long BasicIridiumSBD<StreamT, Policy>::getMOMSN()
+{
+   return this->lastMOMSN;
+}
+
+// In a mailbox drain, the MTMSN of the last message handed to the sink
+template <class StreamT, class Policy>
+long BasicIridiumSBD<StreamT, Policy>::getMTMSN()
+{
+   return this->lastMTMSN;
+}
+
+// Tell the outbox how the session carrying its message ended
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::outboxDone(int ret)
+{
+   if (!sessionFromOutbox)
+      return;
+   sessionFromOutbox = false;
+   if (this->outbox)
+      this->outbox->complete(ret == ISBD_SUCCESS);
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::setMetrics(ISBDMetrics *metrics)
+{
+   if (!Policy::metrics)
+      return;
+   this->metrics = metrics;
+   this->metricCommand = ISBD_COMMAND_COUNT;
+   this->awakeSince = millis(); // awake time is counted from here on
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::snapshotMetrics(ISBDMetrics &snapshot)
+{
+   if (!metering())
+   {
+      memset(&snapshot, 0, sizeof(snapshot));
+      return;
+   }
+   snapshot = *metrics;
+   if (!this->asleep)
+      bump(snapshot.awakeTime, millis() - awakeSince);
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::useCommandEcho(bool enable) // false to run with ATE0, applied at begin()
+{
+   if (enable != this->echoEnabled)
+      this->profileSaved = false; // the stored profile has the other echo setting
+   this->echoEnabled = enable;
+}
+
+// Signal strength (0-5) from the most recent +CIEV indication; needs useSignalIndications()
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::getSignalIndication()
+{
+   return this->signalIndication;
+}
+
+// Signal strength (0-5) from the most recent successful getSignalQuality(); it ages, but
+// needs no +CIER
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::getLastSignalQuality()
+{
+   return this->signalQuality;
+}
+
+// Milliseconds from power-on to ready in the last successful begin()
+template <class StreamT, class Policy>
+unsigned long BasicIridiumSBD<StreamT, Policy>::getWakeLatency()
+{
+   return this->wakeLatency;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::enableRingAlerts(bool enable) // true to enable SBDRING alerts and RING signal pin
+{
+   this->ringAlertsEnabled = Policy::ringAlerts && enable;
+   if (enable)
+      this->ringAsserted = false;
+}
+
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::hasRingAsserted()
+{
+   if (!Policy::ringAlerts || !ringAlertsEnabled)
+      return false;
+
+   if (!reentrant)
+   {
+      // It's possible that the SBDRING message comes while we're not doing anything
+      filterUnsolicited();
+   }
+
+   bool ret = ringAsserted;
+   ringAsserted = false;
+   return ret;
+}
+
+// Iridium system time as Unix seconds plus milliseconds, using integer arithmetic only
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::getSystemTimeEpoch(uint32_t &unixSeconds, uint16_t &ms)
+{
+   // Answer from the cached reading while it is fresh; otherwise ask the modem
+   if (!systemTimeFresh())
+   {
+      uint32_t ticks;
+
+      send(F("AT-MSSTM\r"));
+      if (!waitForATFields(&ticks, 1, 16, 0xFFFFFFFFUL, "-MSSTM: "))
+         return cancelled() ? ISBD_CANCELLED : ISBD_PROTOCOL_ERROR;
+
+      // Anything but a hex number is "no network service"
+      if (!matchFieldsValid)
+      {
+         if (metering())
+            bump(metrics->msstmNotReady);
+         return ISBD_NO_NETWORK;
+      }
+      recordSystemTime(ticks);
+   }
+
+   /* Strategy: split the 90 ms tick count into thousands of ticks (exactly 90 seconds
+      each) and a remainder that won't overflow when we scale by 90.  Then add the local
+      time elapsed since the reading arrived.
+
+      Many thanks to Scott Weldon for the original version of this suggestion.
+   */
+   uint32_t secs = (msstmCacheTicks / 1000) * 90;
+   uint32_t millisecs = (msstmCacheTicks % 1000) * 90 + driftCorrected(millis() - msstmCacheMillis);
+   unixSeconds = ISBD_IRIDIUM_EPOCH + secs + millisecs / 1000;
+   ms = millisecs % 1000;
+   return ISBD_SUCCESS;
+}
+
+// Broken-down UTC form of getSystemTimeEpoch
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::getSystemTime(struct tm &tm)
+{
+   uint32_t unixSeconds;
+   uint16_t ms;
+   int ret = getSystemTimeEpoch(unixSeconds, ms);
+   if (ret == ISBD_SUCCESS)
+      epochToTM(unixSeconds, tm);
+   return ret;
+}
+
+// Convert Unix seconds to UTC calendar fields (days-to-civil algorithm; valid 1970-2105)
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::epochToTM(uint32_t unixSeconds, struct tm &tm)
+{
+   uint32_t days = unixSeconds / 86400UL;
+   uint32_t secs = unixSeconds % 86400UL;
+
+   memset(&tm, 0, sizeof tm);
+   tm.tm_hour = secs / 3600;
+   tm.tm_min = secs / 60 % 60;
+   tm.tm_sec = secs % 60;
+   tm.tm_wday = (days + 4) % 7; // 1 January 1970 was a Thursday
+
+   // Shift to an era beginning 1 March 0000 so leap days fall at the end of each year
+   uint32_t z = days + 719468UL;
+   uint32_t era = z / 146097UL;
+   uint32_t doe = z - era * 146097UL;
+   uint32_t yoe = (doe - doe / 1460 + doe / 36524UL - doe / 146096UL) / 365;
+   uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+   uint32_t mp = (5 * doy + 2) / 153;
+   uint32_t year = yoe + era * 400 + (mp >= 10 ? 1 : 0);
+   uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+
+   tm.tm_year = year - 1900;
+   tm.tm_mon = month - 1;
+   tm.tm_mday = doy - (153 * mp + 2) / 5 + 1;
+
+   bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+   static const uint16_t firstDayOfMonth[12] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+   tm.tm_yday = firstDayOfMonth[tm.tm_mon] + tm.tm_mday - 1 + (leap && tm.tm_mon > 1 ? 1 : 0);
+}
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::getFirmwareVersion(char *version, size_t bufferSize)
+{
+   if (bufferSize < 8)
+      return ISBD_RX_OVERFLOW;
+
+   send(F("AT+CGMR\r"));
+   if (!waitForATResponse(version, bufferSize, "Call Processor Version: "))
+      return cancelled() ? ISBD_CANCELLED : ISBD_PROTOCOL_ERROR;
+
+   return ISBD_SUCCESS;
+}
+
+/*
+Private interface
+*/
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::internalBegin()
+{
+   diagprint(F("Calling internalBegin\r\n"));
+
+   if (!this->asleep)
+      return ISBD_ALREADY_AWAKE;
+
+   power(true); // power on
+   unsigned long wakeStart = millis();
+
+   bool modemAlive = false;
+
+   if (fastWakeEnabled)
+   {
+      // Probe with a short timeout that doubles on each miss, so a modem that boots
+      // quickly is noticed within a few tens of milliseconds
+      unsigned long probeTime = ISBD_WAKE_PROBE_MIN_TIME;
+      for (unsigned long start = millis(); !modemAlive && millis() - start < 1000UL * ISBD_STARTUP_MAX_TIME;)
+      {
+         modemAlive = probeModem(probeTime);
+         if (cancelled())
+            return ISBD_CANCELLED;
+         if (probeTime < ISBD_WAKE_PROBE_MAX_TIME)
+            probeTime *= 2;
+      }
+   }
+
+   else
+   {
+      unsigned long startupTime = 500; //ms
+      if (!idleFor(startupTime))
+         return ISBD_CANCELLED;
+
+      // Turn on modem and wait for a response from "AT" command to begin
+      for (unsigned long start = millis(); !modemAlive && millis() - start < 1000UL * ISBD_STARTUP_MAX_TIME;)
+      {
+         send(F("AT\r"));
+         modemAlive = waitForATResponse();
+         if (cancelled())
+            return ISBD_CANCELLED;
+      }
+   }
+
+   if (!modemAlive)
+   {
+      diagprint(F("No modem detected.\r\n"));
+      trace(ISBD_TRACE_ERROR, ISBD_EVENT_NO_MODEM);
+      return ISBD_NO_MODEM_DETECTED;
+   }
+
+   // The usual initialization sequence, unless the modem restored it from its stored profile
+   if (!(fastWakeEnabled && profileSaved))
+   {
+      const char *strings[3] = { echoEnabled ? "ATE1\r" : "ATE0\r", "AT&D0\r", "AT&K0\r" };
+      for (int i=0; i<3; ++i)
+      {
+         send(strings[i]); 
+         if (!waitForATResponse())
+            return cancelled() ? ISBD_CANCELLED : ISBD_PROTOCOL_ERROR;
+      }
+
+      // Store the configuration as profile 0 and make it the power-up default.  Failure only
+      // costs the fast path, so carry on regardless.
+      if (fastWakeEnabled)
+      {
+         send(F("AT&W0\r"));
+         profileSaved = waitForATResponse();
+         if (profileSaved)
+         {
+            send(F("AT&Y0\r"));
+            profileSaved = waitForATResponse();
+         }
+         if (cancelled())
+            return ISBD_CANCELLED;
+         diagprint(F("Modem profile")); diagprint(profileSaved ? F("") : F(" NOT")); diagprint(F(" saved.\r\n"));
+      }
+   }
+
+   // Enable or disable RING alerts as requested by user
+   // By default they are on if a RING pin was supplied on constructor
+   diagprint(F("Ring alerts are")); diagprint(ringAlertsEnabled ? F("") : F(" NOT")); diagprint(F(" enabled.\r\n"));
+   send(ringAlertsEnabled ? F("AT+SBDMTA=1\r") : F("AT+SBDMTA=0\r"));
+   if (!waitForATResponse())
+      return cancelled() ? ISBD_CANCELLED : ISBD_PROTOCOL_ERROR;
+
+   // Signal strength and service availability indications drive SBDIX retries if requested
+   signalIndication = serviceIndication = signalQuality = -1;
+   signalIndicationsActive = false;
+   if (signalIndicationsEnabled)
+   {
+      diagprint(F("Enabling signal indications\r\n"));
+      send(F("AT+CIER=1,1,1\r"));
+      if (!waitForATResponse())
+         return cancelled() ? ISBD_CANCELLED : ISBD_PROTOCOL_ERROR;
+      signalIndicationsActive = true;
+   }
+
+   // Decide whether the internal MSSTM workaround should be enforced on TX/RX
+   // By default it is unless the firmware rev is >= TA13001.  The firmware can't change
+   // while we sleep, so on a fast wake the earlier decision stands.
+   if (Policy::msstmWorkaround && !(fastWakeEnabled && firmwareChecked))
+   {
+      char version[8];
+      int ret = getFirmwareVersion(version, sizeof(version));
+      if (ret != ISBD_SUCCESS)
+      {
+         diagprint(F("Unknown FW version\r\n"));
+         msstmWorkaroundRequested = true;
+         trace(ISBD_TRACE_INFO, ISBD_EVENT_FIRMWARE, -1, 1);
+      }
+      else
+      {
+         diagprint(F("Firmware version is ")); diagprint(version); diagprint(F("\r\n"));
+         if (version[0] == 'T' && version[1] == 'A')
+         {
+            unsigned long ver = strtoul(version + 2, NULL, 10);
+            msstmWorkaroundRequested = ver < ISBD_MSSTM_WORKAROUND_FW_VER;
+            trace(ISBD_TRACE_INFO, ISBD_EVENT_FIRMWARE, (long)ver, msstmWorkaroundRequested);
+         }
+         firmwareChecked = true;
+      }
+   }
+   diagprint(F("MSSTM workaround is")); diagprint(msstmWorkaroundRequested ? F("") : F(" NOT")); diagprint(F(" enforced.\r\n"));
+
+   // Done!
+   wakeLatency = millis() - wakeStart;
+   diagprint(F("InternalBegin: success in ")); diagprint((uint16_t)(wakeLatency < 65535UL ? wakeLatency : 65535UL)); diagprint(F(" ms\r\n"));
+   trace(ISBD_TRACE_INFO, ISBD_EVENT_READY, (long)wakeLatency, fastWakeEnabled && profileSaved);
+   return ISBD_SUCCESS;
+}
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::internalSendReceiveSBD(const char *txTxtMessage, const ISBDSegment *segments, size_t segmentCount, uint8_t *rxBuffer, size_t *prxBufferSize,
+   ISBDReceiveSink sink, void *sinkContext)
+{
+   diagprint(F("internalSendReceive\r\n"));
+
+   int ret = startSession(txTxtMessage, segments, segmentCount, rxBuffer, prxBufferSize, sink, sinkContext);
+   if (ret != ISBD_SUCCESS)
+      return ret;
+
+   // Drive the session state machine to completion, giving the client a chance to cancel
+   while ((ret = stepSession()) == ISBD_BUSY)
+   {
+      if (cancelled())
+      {
+         ret = ISBD_CANCELLED;
+         break;
+      }
+      idleSession();
+   }
+
+   finishSession(ret);
+   return ret;
+}
+
+// Return to idle with the session's final result
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::finishSession(int ret)
+{
+   this->sessionState = SESSION_IDLE;
+   this->sessionResult = ret;
+   endATResponse(false); // including one abandoned before it was answered
+   outboxDone(ret);
+   if (metering())
+   {
+      bump(metrics->sessions);
+      bump(metrics->attempts[sessionAttempts < ISBD_ATTEMPT_SLOTS ? sessionAttempts : ISBD_ATTEMPT_SLOTS - 1]);
+   }
+}
+
+// Validate the request and issue the command that loads the MO buffer
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startSession(const char *txTxtMessage, const ISBDSegment *segments, size_t segmentCount, uint8_t *rxBuffer, size_t *prxBufferSize,
+   ISBDReceiveSink sink, void *sinkContext, bool loadMO)
+{
+   if (this->asleep)
+      return ISBD_IS_ASLEEP;
+
+   // A lone segment (or text) is kept in sessionSingle so callers can describe it on the stack
+   sessionTxSize = 0;
+   for (size_t i=0; i<segmentCount; ++i)
+      sessionTxSize += segments[i].size;
+
+   sessionTxText = sessionTxSize == 0;
+   if (sessionTxText)
+   {
+      // Text messages end at the first embedded \r
+      sessionSingle.data = (const uint8_t *)txTxtMessage;
+      sessionSingle.size = sessionTxSize = txTxtMessage ? strcspn(txTxtMessage, "\r") : 0;
+      segments = &sessionSingle;
+      segmentCount = 1;
+   }
+   else if (segmentCount == 1)
+   {
+      sessionSingle = segments[0];
+      segments = &sessionSingle;
+   }
+
+   if (sessionTxSize > ISBD_MAX_MESSAGE_LENGTH)
+      return ISBD_MSG_TOO_LONG;
+
+   sessionSegments = segments;
+   sessionSegmentCount = segmentCount;
+   sessionSegment = 0;
+   sessionTxPos = 0;
+   sessionChecksum = 0;
+   sessionRxBase = rxBuffer;
+   sessionRxBufferSize = prxBufferSize;
+   sessionRxCapacity = prxBufferSize ? *prxBufferSize : 0;
+   sessionSink = sink;
+   sessionSinkContext = sinkContext;
+   sessionMailboxSink = NULL;
+   sessionSkipMSSTM = false;
+   sessionForceAttempt = false;
+   sessionBackoff = 1000UL * sbdixInterval;
+   sessionAttempts = 0;
+   lastMOMSN = lastMTMSN = -1L;
+
+   if (!loadMO)
+      return ISBD_SUCCESS;
+
+   if (!sessionTxText) // Binary transmission
+   {
+      send(F("AT+SBDWB="), true, false);
+      send((uint16_t)sessionTxSize);
+      send(F("\r"), false);
+      expectSession(SESSION_WAIT_READY, NULL, 0, NULL, "READY\r\n");
+   }
+   else if (txTxtMessage == NULL) // It's ok to have a NULL txtTxtMessage if the transaction is RX only
+   {
+      send(F("AT+SBDWT=\r"));
+      expectSession(SESSION_WAIT_WRITTEN, NULL, 0, NULL, "OK\r\n");
+   }
+   else // Text transmission, using the long string implementation
+   {
+      send(F("AT+SBDWT\r"));
+      expectSession(SESSION_WAIT_READY, NULL, 0, NULL, "READY\r\n");
+   }
+
+   return ISBD_SUCCESS;
+}
+
+// Set up a session that clears the MO buffer once, then loops +SBDIX/+SBDRB while messages remain
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::startMailbox(uint8_t *rxBuffer, size_t rxBufferSize, ISBDMailboxSink sink, void *context, int maxMessages)
+{
+   if (this->asleep)
+      return ISBD_IS_ASLEEP;
+
+   if (!rxBuffer || !sink)
+      return ISBD_PROTOCOL_ERROR;
+
+   int ret = startSession(NULL, NULL, 0, NULL, NULL, NULL, NULL, false);
+   if (ret != ISBD_SUCCESS)
+      return ret;
+
+   sessionRxBase = rxBuffer;
+   sessionRxCapacity = rxBufferSize;
+   sessionMailboxSink = sink;
+   sessionMailboxContext = context;
+   sessionMailboxLeft = maxMessages > 0 ? maxMessages : -1;
+
+   send(F("AT+SBDD0\r"));
+   expectSession(SESSION_WAIT_WRITTEN, NULL, 0, NULL, "OK\r\n");
+   return ISBD_SUCCESS;
+}
+
+// Advance the send/receive session as far as it can go without blocking.
+// Returns ISBD_BUSY while the session continues, otherwise its final result.
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::stepSession()
+{
+   drainSerial();
+   checkRingPin();
+
+   int ret;
+   switch (sessionState)
+   {
+   case SESSION_WAIT_READY:
+      if ((ret = pollATResponse()) != ISBD_SUCCESS)
+         return ret;
+      if (sessionTxText)
+         consoleprint(F(">> "));
+      sessionState = SESSION_WRITE_PAYLOAD;
+      break;
+
+   case SESSION_WRITE_PAYLOAD:
+   {
+      // Write a few bytes per step so the caller is never held up by a full serial buffer,
+      // moving on through the segments as each one is exhausted
+      for (size_t budget = ISBD_POLL_WRITE_CHUNK; budget > 0 && sessionSegment < sessionSegmentCount;)
+      {
+         const ISBDSegment &segment = sessionSegments[sessionSegment];
+         size_t n = segment.size - sessionTxPos;
+         if (n > budget)
+            n = budget;
+         const uint8_t *p = segment.data + sessionTxPos;
+         uint8_t chunk[ISBD_POLL_WRITE_CHUNK];
+         if (segment.data == NULL && n > 0) // a queued message that has to be read out of storage
+         {
+            n = this->outbox ? this->outbox->read(sessionTxPos, chunk, n) : 0;
+            if (n == 0)
+               return ISBD_STORAGE_ERROR;
+            p = chunk;
+         }
+         Port::write(stream, p, n);
+         if (metering())
+            bump(metrics->bytesOut, n);
+         sessionChecksum += checksum(p, n);
+         if (sessionTxText)
+            for (size_t i=0; i<n; ++i)
+               consoleprint((char)p[i]);
+         sessionTxPos += n;
+         budget -= n;
+
+         if (sessionTxPos == segment.size)
+         {
+            ++sessionSegment;
+            sessionTxPos = 0;
+         }
+      }
+
+      if (sessionSegment < sessionSegmentCount)
+         break;
+
+      if (sessionTxText)
+      {
+         consoleprint(F("\r\n"));
+         Port::write(stream, '\r');
+         if (metering())
+            bump(metrics->bytesOut);
+      }
+      else
+      {
+         consoleprint(F("["));
+         consoleprint((uint16_t)sessionTxSize);
+         consoleprint(F(" bytes]"));
+
+         diagprint(F("Checksum:"));
+         diagprint(sessionChecksum);
+         diagprint(F("\r\n"));
+
+         uint8_t trailer[2] = { (uint8_t)(sessionChecksum >> 8), (uint8_t)(sessionChecksum & 0xFF) };
+         Port::write(stream, trailer, sizeof(trailer));
+         if (metering())
+            bump(metrics->bytesOut, sizeof(trailer));
+      }
+      expectSession(SESSION_WAIT_WRITTEN, NULL, 0, NULL, "OK\r\n");
+      break;
+   }
+
+   case SESSION_WAIT_WRITTEN:
+      if ((ret = pollATResponse()) != ISBD_SUCCESS)
+         return ret;
+      // 0 = success, 1 = timeout, 2 = bad checksum, 3 = bad size
+      if (matchResultCode > 0)
+      {
+         diagprint(F("MO buffer write failed: "));
+         diagprint((uint16_t)matchResultCode);
+         diagprint(F("\r\n"));
+         trace(ISBD_TRACE_ERROR, ISBD_EVENT_MO_WRITE, matchResultCode, (long)sessionTxSize);
+         return ISBD_PROTOCOL_ERROR;
+      }
+      trace(ISBD_TRACE_DEBUG, ISBD_EVENT_MO_WRITE, 0, (long)sessionTxSize);
+      // Long SBDIX loop begins here
+      sessionStart = millis();
+      sessionState = SESSION_START_SBDIX;
+      break;
+
+   case SESSION_START_SBDIX:
+      if (sessionExpired())
+         return ISBD_SENDRECEIVE_TIMEOUT;
+
+      // With signal indications on, don't waste charge on an attempt that cannot succeed
+      if (this->signalIndicationsActive && !sessionForceAttempt && !linkUsable())
+      {
+         diagprint(F("Waiting for service indication...\r\n"));
+         waitSession(0);
+         break;
+      }
+      sessionForceAttempt = false;
+
+      // A recent valid system time proves the modem is past the erratum; no need to ask again
+      if (Policy::msstmWorkaround && this->msstmWorkaroundRequested && !sessionSkipMSSTM && !systemTimeFresh())
+      {
+         /*
+         According to Iridium 9602 Product Bulletin of 7 May 2013, to overcome a system erratum:
+
+         "Before attempting any of the following commands: +SBDDET, +SBDREG, +SBDI, +SBDIX, +SBDIXA the field application 
+         should issue the AT command AT-MSSTM to the transceiver and evaluate the response to determine if it is valid or not:
+
+         Valid Response: "-MSSTM: XXXXXXXX" where XXXXXXXX is an eight-digit hexadecimal number.
+
+         Invalid Response: "-MSSTM: no network service"
+
+         If the response is invalid, the field application should wait and recheck system time until a valid response is 
+         obtained before proceeding. 
+
+         This will ensure that the Iridium SBD transceiver has received a valid system time before attempting SBD communication. 
+         The Iridium SBD transceiver will receive the valid system time from the Iridium network when it has a good link to the 
+         satellite. Ensuring that the received signal strength reported in response to AT command +CSQ and +CIER is above 2-3 bars 
+         before attempting SBD communication will protect against lockout.
+         */
+         send(F("AT-MSSTM\r"));
+         expectSessionFields(SESSION_WAIT_MSSTM, 1, 16, 0xFFFFFFFFUL, "-MSSTM: ");
+      }
+      else
+      {
+         send(F("AT+SBDIX\r"));
+         expectSessionFields(SESSION_WAIT_SBDIX, 6, 10, 65535UL, "+SBDIX: ");
+      }
+      break;
+
+   case SESSION_WAIT_MSSTM:
+      if ((ret = pollATResponse()) != ISBD_SUCCESS)
+         return ret;
+
+      // The response was either an 8-digit hex number or the string "no network service"
+      trace(ISBD_TRACE_DEBUG, ISBD_EVENT_MSSTM, matchFieldsValid ? (long)sessionFields[0] : -1L);
+      if (matchFieldsValid)
+      {
+         recordSystemTime(sessionFields[0]);
+         send(F("AT+SBDIX\r"));
+         expectSessionFields(SESSION_WAIT_SBDIX, 6, 10, 65535UL, "+SBDIX: ");
+      }
+      else
+      {
+         if (metering())
+            bump(metrics->msstmNotReady);
+         diagprint(F("Waiting for MSSTM retry...\r\n"));
+         waitSession(ISBD_MSSTM_RETRY_INTERVAL);
+      }
+      break;
+
+   case SESSION_WAIT_SBDIX:
+   {
+      if ((ret = pollATResponse()) != ISBD_SUCCESS)
+         return ret;
+
+      // +SBDIX: <MO status>, <MOMSN>, <MT status>, <MTMSN>, <MT length>, <MT queued>
+      if (!matchFieldsValid)
+         return ISBD_PROTOCOL_ERROR;
+      uint16_t moCode = sessionFields[0], mtCode = sessionFields[2], mtMSN = sessionFields[3], mtRemaining = sessionFields[5];
+
+      diagprint(F("SBDIX MO code: "));
+      diagprint(moCode);
+      diagprint(F("\r\n"));
+      trace(ISBD_TRACE_INFO, ISBD_EVENT_SBDIX, moCode, (long)sessionFields[1], mtCode, mtMSN);
+      ++sessionAttempts;
+      lastMOMSN = sessionFields[1];
+      if (metering())
+         countSBDIX(moCode, mtCode);
+
+      if (moCode <= 4) // this range indicates successful return!
+      {
+         diagprint(F("SBDIX success!\r\n"));
+
+         this->remainingMessages = mtRemaining;
+         sessionMTMSN = mtMSN;
+         if (mtCode == 1 && mtHistory && mtHistory->seen(mtMSN))
+         {
+            // A repeat of a message already delivered: leave it unread
+            diagprint(F("Duplicate MT message ignored\r\n"));
+            trace(ISBD_TRACE_WARNING, ISBD_EVENT_MT_DUPLICATE, mtMSN);
+            if (metering())
+               bump(metrics->mtDuplicates);
+            if (sessionMailboxSink && this->remainingMessages > 0 && sessionMailboxLeft != 0)
+            {
+               sessionSkipMSSTM = true;
+               sessionStart = millis();
+               sessionState = SESSION_START_SBDIX;
+               break;
+            }
+            mtCode = 0;
+         }
+
+         if (mtCode == 1 && (sessionRxBase || sessionSink)) // retrieved 1 message
+         {
+            diagprint(F("Incoming message!\r\n"));
+            sessionRxBuffer = sessionRxBase;
+            sessionRxRoom = sessionRxCapacity;
+            sessionRxOverflow = false;
+            send(F("AT+SBDRB\r"));
+            if (echoEnabled)
+            {
+               expectSession(SESSION_WAIT_SBDRB_ECHO, NULL, 0, NULL, "AT+SBDRB\r"); // waits for its own echo
+               break;
+            }
+
+            // Without echo the binary response is the first thing the modem sends
+            beginSBDRB();
+            break;
+         }
+
+         // No data returned
+         if (sessionRxBufferSize)
+            *sessionRxBufferSize = 0;
+         return ISBD_SUCCESS;
+      }
+
+      else if (moCode == 12 || moCode == 14 || moCode == 16) // fatal failure: no retry
+      {
+         diagprint(F("SBDIX fatal!\r\n"));
+         return ISBD_SBDIX_FATAL_ERROR;
+      }
+
+      // retry
+      diagprint(F("Waiting for SBDIX retry...\r\n"));
+      trace(ISBD_TRACE_WARNING, ISBD_EVENT_SBDIX_RETRY, moCode, sbdixInterval);
+      sessionSkipMSSTM = false;
+      waitSession(sbdixInterval);
+      break;
+   }
+
+   case SESSION_RETRY_WAIT:
+   {
+      // Keep the unsolicited code filter fed so +CIEV indications are seen while we wait
+      while (filteredavailable() > 0)
+         filteredread();
+
+      // However long the backoff has grown, the session deadline stands
+      if (sessionExpired())
+         return ISBD_SENDRECEIVE_TIMEOUT;
+
+      unsigned long elapsed = millis() - stateStart;
+      if (elapsed < stateDuration) // never sooner than the supercap recharge floor
+         break;
+
+      if (!this->signalIndicationsActive || linkUsable())
+      {
+         sessionState = SESSION_START_SBDIX;
+      }
+      else if (elapsed >= stateDuration + sessionBackoff)
+      {
+         // Sky still looks blocked: try anyway in case an indication was missed, and back off further
+         diagprint(F("No service indication, trying anyway\r\n"));
+         sessionForceAttempt = true;
+         if (sessionBackoff < ISBD_CIER_MAX_BACKOFF_FACTOR * 1000UL * sbdixInterval)
+            sessionBackoff *= 2;
+         sessionState = SESSION_START_SBDIX;
+      }
+      break;
+   }
+
+   case SESSION_WAIT_SBDRB_ECHO:
+      if ((ret = pollATResponse()) != ISBD_SUCCESS)
+         return ret;
+      beginSBDRB();
+      break;
+
+   case SESSION_READ_SBDRB:
+      // Time to read the binary data: size[2], body[size], checksum[2]
+      while (rxAvailable() > 0)
+      {
+         if (sbdrbPos >= 2 && sbdrbPos < sbdrbSize + 2)
+         {
+            // Hand the body over in contiguous runs straight out of the receive ring
+            const uint8_t *run;
+            size_t n = rxContiguous(run);
+            if (n > (size_t)(sbdrbSize + 2 - sbdrbPos))
+               n = sbdrbSize + 2 - sbdrbPos;
+            receiveMT(run, n);
+            rxConsume(n);
+            sbdrbPos += n;
+            continue;
+         }
+
+         uint8_t c = rxRead();
+         if (sbdrbPos < 2)
+         {
+            sbdrbSize = 256 * sbdrbSize + c;
+            if (++sbdrbPos == 2)
+            {
+               consoleprint(F("[Binary size:"));
+               consoleprint(sbdrbSize);
+               consoleprint(F("]"));
+
+               // No modem sends more than this: the stream is out of step, so don't wait
+               // for a body that isn't coming, and drop what has arrived so far
+               if (sbdrbSize > ISBD_MAX_MT_MESSAGE_LENGTH)
+               {
+                  while (rxRead() >= 0)
+                     ;
+                  stopCommandTimer(false);
+                  diagprint(F("Impossible MT size\r\n"));
+                  return ISBD_PROTOCOL_ERROR;
+               }
+            }
+         }
+         else
+         {
+            ++sbdrbPos;
+            sessionChecksum = sbdrbPos == sbdrbSize + 3 ? c : 256 * sessionChecksum + c;
+            if (sbdrbPos == sbdrbSize + 4)
+            {
+               stopCommandTimer(true);
+               consoleprint(F("[csum:"));
+               consoleprint(sessionChecksum);
+               consoleprint(F("]"));
+
+               if (sessionChecksum != sbdrbSum)
+               {
+                  diagprint(F("MT checksum mismatch, computed "));
+                  diagprint(sbdrbSum);
+                  diagprint(F("\r\n"));
+                  trace(ISBD_TRACE_ERROR, ISBD_EVENT_MT_CHECKSUM, sessionChecksum, sbdrbSum);
+               }
+
+               // Return actual size of returned buffer
+               if (sessionRxBufferSize)
+                  *sessionRxBufferSize = (size_t)sbdrbSize;
+
+               // Wait for final OK
+               expectSession(SESSION_WAIT_SBDRB_OK, NULL, 0, NULL, "OK\r\n");
+               return ISBD_BUSY;
+            }
+         }
+      }
+
+      if (millis() - stateStart >= 1000UL * atTimeout)
+      {
+         stopCommandTimer(false);
+         return ISBD_SENDRECEIVE_TIMEOUT;
+      }
+      break;
+
+   case SESSION_WAIT_SBDRB_OK:
+      if ((ret = pollATResponse()) != ISBD_SUCCESS)
+         return ret;
+      if (sessionChecksum != sbdrbSum)
+         return ISBD_CHECKSUM_ERROR;
+      if (sessionRxOverflow)
+         return ISBD_RX_OVERFLOW;
+      trace(ISBD_TRACE_INFO, ISBD_EVENT_MT_RECEIVED, sbdrbSize, sessionMTMSN);
+      lastMTMSN = sessionMTMSN;
+
+      if (sessionMailboxSink)
+      {
+         sessionMailboxSink(sessionMailboxContext, sessionMTMSN, sessionRxBase, sbdrbSize);
+         recordMT();
+
+         // Go straight back for the next one: the MO buffer is already clear and the
+         // system time was just proven valid, so only +SBDIX/+SBDRB are needed
+         if (sessionMailboxLeft > 0)
+            --sessionMailboxLeft;
+         if (this->remainingMessages > 0 && sessionMailboxLeft != 0)
+         {
+            sessionSkipMSSTM = true;
+            sessionStart = millis();
+            sessionState = SESSION_START_SBDIX;
+            return ISBD_BUSY;
+         }
+         return ISBD_SUCCESS;
+      }
+
+      // The message is in the client's buffer, or has been streamed to its sink
+      recordMT();
+      return ISBD_SUCCESS;
+   }
+
+   return ISBD_BUSY;
+}
+
+// 16-bit sum of bytes used by +SBDWB and +SBDRB.  Summed four bytes per iteration into a
+// wide accumulator; the result is only ever used modulo 65536.
+template <class StreamT, class Policy>
+uint16_t BasicIridiumSBD<StreamT, Policy>::checksum(const uint8_t *data, size_t size)
+{
+   unsigned long sum = 0;
+   for (; size >= 4; size -= 4, data += 4)
+      sum += (uint16_t)data[0] + data[1] + data[2] + data[3];
+   while (size--)
+      sum += *data++;
+   return (uint16_t)sum;
+}
+
+// Start reading the binary +SBDRB response: size[2], body[size], checksum[2]
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::beginSBDRB()
+{
+   sbdrbSize = 0;
+   sbdrbPos = 0;
+   sbdrbSum = 0;
+   sessionState = SESSION_READ_SBDRB;
+   stateStart = millis();
+}
+
+// Deliver a run of MT message body to the client's sink or buffer, summing it as we go
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::receiveMT(const uint8_t *data, size_t size)
+{
+   sbdrbSum += checksum(data, size);
+
+   if (sessionSink)
+   {
+      sessionSink(sessionSinkContext, data, size);
+   }
+   else if (sessionRxBuffer)
+   {
+      size_t n = size < sessionRxRoom ? size : sessionRxRoom;
+      memcpy(sessionRxBuffer, data, n);
+      sessionRxBuffer += n;
+      sessionRxRoom -= n;
+      if (n < size)
+         sessionRxOverflow = true;
+   }
+}
+
+// Issue-side helper: arm the response matcher and move the session to "state"
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::expectSession(uint8_t state, char *response, int responseSize, const char *prompt, const char *terminator)
+{
+   beginATResponse(response, responseSize, prompt, terminator);
+   sessionState = state;
+   stateStart = millis();
+}
+
+// Await a response whose numeric fields are decoded into sessionFields[]
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::expectSessionFields(uint8_t state, uint8_t count, uint8_t base, uint32_t max, const char *prompt)
+{
+   beginATFields(sessionFields, count, base, max, prompt);
+   sessionState = state;
+   stateStart = millis();
+}
+
+// Park the session for "seconds" before the next SBDIX attempt, or until the session's
+// time runs out if that is sooner
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::waitSession(int seconds)
+{
+   unsigned long elapsed = millis() - sessionStart, limit = 1000UL * this->sendReceiveTimeout;
+   sessionState = SESSION_RETRY_WAIT;
+   stateStart = millis();
+   stateDuration = 1000UL * seconds;
+   if (stateDuration > limit - elapsed)
+      stateDuration = elapsed < limit ? limit - elapsed : 0;
+}
+
+// Has the +SBDIX loop run out of time?
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::sessionExpired()
+{
+   if (millis() - sessionStart < 1000UL * this->sendReceiveTimeout)
+      return false;
+   diagprint(F("SBDIX timeout!\r\n"));
+   trace(ISBD_TRACE_ERROR, ISBD_EVENT_SESSION_TIMEOUT, this->sendReceiveTimeout);
+   return true;
+}
+
+// Let ms pass, running the client callback meanwhile.  Returns false if the client cancelled.
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::idleFor(unsigned long ms)
+{
+   for (unsigned long start = millis(), elapsed = 0; elapsed < ms; elapsed = millis() - start)
+   {
+      if (cancelled())
+         return false;
+      Port::waitForInput(stream, ms - elapsed < ISBD_IDLE_WAIT ? ms - elapsed : ISBD_IDLE_WAIT);
+   }
+   return true;
+}
+
+// Between steps of a blocking session, let the port sleep until the modem has something to
+// say if that is all the session is waiting for
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::idleSession()
+{
+   unsigned long wait = ISBD_IDLE_WAIT;
+   if (sessionState == SESSION_WRITE_PAYLOAD || sessionState == SESSION_START_SBDIX)
+      return; // more to do straight away
+
+   if (sessionState == SESSION_RETRY_WAIT)
+   {
+      unsigned long elapsed = millis() - stateStart;
+      if (elapsed < stateDuration && stateDuration - elapsed < wait)
+         wait = stateDuration - elapsed;
+   }
+
+   // The step consumed everything it could, but the client callback may have drained more
+   if (rxAvailable() == 0)
+      Port::waitForInput(stream, wait);
+}
+
+// According to the most recent +CIEV indications, is an SBD session worth attempting?
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::linkUsable()
+{
+   return serviceIndication == 1 && signalIndication >= minimumSignal;
+}
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::internalGetSignalQuality(int &quality)
+{
+   if (this->asleep)
+      return ISBD_IS_ASLEEP;
+
+   uint32_t csq;
+
+   send(F("AT+CSQ\r"));
+   if (!waitForATFields(&csq, 1, 10, 5, "+CSQ:"))
+      return cancelled() ? ISBD_CANCELLED : ISBD_PROTOCOL_ERROR;
+
+   if (!matchFieldsValid)
+      return ISBD_PROTOCOL_ERROR;
+
+   quality = this->signalQuality = (int)csq;
+   return ISBD_SUCCESS;
+}
+
+template <class StreamT, class Policy>
+const uint16_t BasicIridiumSBD<StreamT, Policy>::latencyBounds[ISBD_LATENCY_BUCKETS - 1] PROGMEM = { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000 };
+
+// Command prefixes (after "AT") recognised for metrics, and their classes
+template <class StreamT, class Policy>
+const char BasicIridiumSBD<StreamT, Policy>::commandPrefixes[COMMAND_PREFIX_COUNT][7] PROGMEM =
+   { "+SBDIX", "+SBDW", "+SBDD", "+SBDRB", "-MSSTM", "+CSQ", "+CGMR", "+IPR" };
+
+template <class StreamT, class Policy>
+const uint8_t BasicIridiumSBD<StreamT, Policy>::commandClasses[COMMAND_PREFIX_COUNT] PROGMEM = { ISBD_COMMAND_SBDIX, ISBD_COMMAND_SBDW, ISBD_COMMAND_SBDW,
+   ISBD_COMMAND_SBDRB, ISBD_COMMAND_MSSTM, ISBD_COMMAND_CSQ, ISBD_COMMAND_CGMR, ISBD_COMMAND_IPR };
+
+// Note the class of a command just sent and when it went
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::startCommandTimer(const char *command, bool flash)
+{
+   metricCommand = ISBD_COMMAND_OTHER;
+   metricStart = millis();
+   for (uint8_t i=0; i<COMMAND_PREFIX_COUNT; ++i)
+   {
+      PGM_P prefix = commandPrefixes[i];
+      uint8_t j = 0;
+      while (pgm_read_byte(prefix + j) && pgm_read_byte(prefix + j) == (flash ? pgm_read_byte(command + 2 + j) : (uint8_t)command[2 + j]))
+         ++j;
+      if (!pgm_read_byte(prefix + j))
+      {
+         metricCommand = pgm_read_byte(&commandClasses[i]);
+         break;
+      }
+   }
+}
+
+// Record how long the command being timed took to answer, or that it never did
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::stopCommandTimer(bool answered)
+{
+   if (!metering() || metricCommand == ISBD_COMMAND_COUNT)
+      return;
+
+   if (answered)
+   {
+      unsigned long elapsed = millis() - metricStart;
+      uint8_t bucket = 0;
+      while (bucket < ISBD_LATENCY_BUCKETS - 1 && elapsed >= pgm_read_word(&latencyBounds[bucket]))
+         ++bucket;
+      bump(metrics->latency[metricCommand][bucket]);
+   }
+   else
+   {
+      bump(metrics->timeouts[metricCommand]);
+   }
+   metricCommand = ISBD_COMMAND_COUNT;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::countSBDIX(uint16_t moCode, uint16_t mtCode)
+{
+   bump(metrics->sbdixAttempts);
+   bump(metrics->moStatus[moCode < ISBD_MO_STATUS_SLOTS ? moCode : ISBD_MO_STATUS_SLOTS - 1]);
+   bump(metrics->mtStatus[mtCode < 2 ? mtCode : 2]);
+}
+
+template <class StreamT, class Policy>
+const uint32_t BasicIridiumSBD<StreamT, Policy>::iprRates[9] PROGMEM = { 600, 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::internalNegotiateBaudRate(unsigned long baud, ISBDBaudRateHook hook, void *context)
+{
+   if (this->asleep)
+      return ISBD_IS_ASLEEP;
+
+   int code = 0;
+   for (int i=0; i<9; ++i)
+      if (pgm_read_dword(&iprRates[i]) == baud)
+         code = i + 1;
+   if (code == 0 || hook == NULL)
+      return ISBD_UNSUPPORTED_BAUD;
+
+   this->baudRateHook = hook;
+   this->baudRateContext = context;
+   if (baud == this->baudRate)
+      return ISBD_SUCCESS;
+
+   char command[] = "AT+IPR=0\r";
+   command[7] = '0' + code;
+   send(command);
+   if (!waitForATResponse())
+      return cancelled() ? ISBD_CANCELLED : ISBD_UNSUPPORTED_BAUD;
+
+   // The modem changes rate once it has sent OK; follow it and check that it answers
+   unsigned long previous = this->baudRate;
+   int ret = switchBaudRate(baud);
+   if (ret == ISBD_SUCCESS || ret == ISBD_CANCELLED)
+      return ret;
+
+   // No answer.  Go back to the old rate in case the modem never switched, then try the new
+   // one again in case it did and the probes were lost.
+   diagprint(F("No response at new rate, falling back\r\n"));
+   ret = switchBaudRate(previous);
+   if (ret == ISBD_SUCCESS)
+      return ISBD_UNSUPPORTED_BAUD;
+   if (ret != ISBD_CANCELLED)
+      ret = switchBaudRate(baud);
+   return ret == ISBD_NO_MODEM_DETECTED ? ISBD_SERIAL_FAILURE : ret;
+}
+
+// Reconfigure the host port and confirm the modem answers "AT" at the new rate
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::switchBaudRate(unsigned long baud)
+{
+   diagprint(F("Switching to ")); diagprint((uint16_t)(baud / 100)); diagprint(F("00 baud\r\n"));
+   if (!baudRateHook(baudRateContext, baud))
+      return ISBD_SERIAL_FAILURE;
+   this->baudRate = baud;
+
+   // Let the modem's UART settle; anything garbled in the meantime is skipped by the matcher
+   if (!idleFor(ISBD_BAUD_SETTLE_TIME))
+      return ISBD_CANCELLED;
+
+   for (int i=0; i<ISBD_BAUD_PROBES; ++i)
+   {
+      if (probeModem(ISBD_WAKE_PROBE_MAX_TIME))
+         return ISBD_SUCCESS;
+      if (cancelled())
+         return ISBD_CANCELLED;
+   }
+   return ISBD_NO_MODEM_DETECTED;
+}
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::internalSleep()
+{
+   if (this->asleep)
+      return ISBD_IS_ASLEEP;
+
+#if false // recent research suggest this is not what you should do when just sleeping
+   // Best Practices Guide suggests this before shutdown
+   send(F("AT*F\r"));
+
+   if (!waitForATResponse())
+      return cancelled() ? ISBD_CANCELLED : ISBD_PROTOCOL_ERROR;
+#endif
+
+   return ISBD_SUCCESS;
+}
+
+// Wait for response from previous AT command.  This process terminates when "terminator" string is seen or upon timeout.
+// If "prompt" string is provided (example "+CSQ:"), then all characters following prompt up to the next CRLF are
+// stored in response buffer for later parsing by caller.
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::waitForATResponse(char *response, int responseSize, const char *prompt, const char *terminator)
+{
+   beginATResponse(response, responseSize, prompt, terminator);
+   return awaitATResponse(1000UL * atTimeout);
+}
+
+// Like waitForATResponse, but decode the numeric fields following prompt into fields[].
+// The return value says whether OK arrived; matchFieldsValid says whether the fields did.
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::waitForATFields(uint32_t *fields, uint8_t count, uint8_t base, uint32_t max, const char *prompt)
+{
+   beginATFields(fields, count, base, max, prompt);
+   return awaitATResponse(1000UL * atTimeout);
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::beginATFields(uint32_t *fields, uint8_t count, uint8_t base, uint32_t max, const char *prompt)
+{
+   beginATResponse(NULL, 0, prompt, "OK\r\n");
+   memset(fields, 0, count * sizeof(*fields));
+   matchFields = fields;
+   matchFieldMax = max;
+   matchFieldCount = count;
+   matchFieldIndex = 0;
+   matchFieldDigits = 0;
+   matchFieldBase = base;
+   matchFieldError = false;
+   matchFieldsValid = false;
+}
+
+// Accumulate one character of the response into the current field
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::decodeField(char c)
+{
+   if (c == '\r')
+   {
+      matchState = LOOKING_FOR_TERMINATOR;
+      matchFieldsValid = !matchFieldError && matchFieldDigits > 0 && matchFieldIndex == matchFieldCount - 1;
+      return;
+   }
+
+   if (matchFieldError)
+      return;
+
+   uint8_t digit = isdigit(c) ? c - '0' : matchFieldBase == 16 && isxdigit(c) ? (c | 0x20) - 'a' + 10 : 0xFF;
+   uint32_t &value = matchFields[matchFieldIndex];
+   if (digit != 0xFF)
+   {
+      if (digit > matchFieldMax || value > (matchFieldMax - digit) / matchFieldBase)
+         matchFieldError = true;
+      value = value * matchFieldBase + digit;
+      ++matchFieldDigits;
+   }
+   else if (c == ',' && matchFieldDigits > 0 && matchFieldIndex + 1 < matchFieldCount)
+   {
+      ++matchFieldIndex;
+      matchFieldDigits = 0;
+   }
+   else if (c != ' ' || matchFieldDigits > 0)
+   {
+      matchFieldError = true;
+   }
+}
+
+// Send "AT" and wait up to timeoutMs for OK
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::probeModem(unsigned long timeoutMs)
+{
+   send(F("AT\r"));
+   beginATResponse(NULL, 0, NULL, "OK\r\n");
+   return awaitATResponse(timeoutMs);
+}
+
+// Feed arriving characters to the matcher prepared by beginATResponse for up to timeoutMs
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::awaitATResponse(unsigned long timeoutMs)
+{
+   for (unsigned long start=millis(); millis() - start < timeoutMs;)
+   {
+      if (cancelled())
+         return endATResponse(false);
+
+      while (filteredavailable() > 0)
+      {
+         int match = matchATResponse(filteredread());
+         if (match != MATCH_PENDING)
+            stopCommandTimer(true);
+         if (match != MATCH_PENDING)
+            return endATResponse(match == MATCH_TERMINATOR);
+      }
+
+      // Nothing to do until the modem says something
+      unsigned long elapsed = millis() - start;
+      if (elapsed < timeoutMs)
+         Port::waitForInput(stream, timeoutMs - elapsed < ISBD_IDLE_WAIT ? timeoutMs - elapsed : ISBD_IDLE_WAIT);
+   } // timer loop
+   stopCommandTimer(false);
+   return endATResponse(false);
+}
+
+// However the response ended, the line it was in won't be finished now, so deliver
+// the trace records held back for it and send later ones straight to the sink
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::endATResponse(bool matched)
+{
+   matchLineLen = 0;
+   flushTrace();
+   return matched;
+}
+
+// Prepare the matcher used by waitForATResponse and the session state machine
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::beginATResponse(char *response, int responseSize, const char *prompt, const char *terminator)
+{
+   diagprint(F("Waiting for response "));
+   diagprint(terminator);
+   diagprint(F("\r\n"));
+
+   if (response)
+      memset(response, 0, responseSize);
+
+   matchPrompt = prompt;
+   matchTerminator = terminator;
+   matchResponse = response;
+   matchResponseSize = responseSize;
+   matchPromptPos = 0; // Matches chars in prompt
+   matchTerminatorPos = 0; // Matches chars in terminator
+   matchFinalPos[0] = matchFinalPos[1] = 0; // Matches chars in OK/ERROR
+   matchState = prompt ? LOOKING_FOR_PROMPT : LOOKING_FOR_TERMINATOR;
+   matchLineLen = 0;
+   matchAtLineStart = true;
+   matchResultCode = -1;
+   matchFields = NULL;
+   consoleprint(F("<< "));
+}
+
+template <class StreamT, class Policy>
+const char BasicIridiumSBD<StreamT, Policy>::finalResults[2][8] PROGMEM = { "OK\r\n", "ERROR\r\n" };
+
+// Feed one received character to the matcher.  Returns MATCH_TERMINATOR once the terminator
+// has been seen, MATCH_OK or MATCH_ERROR if the modem finished the response some other way,
+// otherwise MATCH_PENDING.
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::matchATResponse(char c)
+{
+   if (matchPrompt)
+   {
+      switch (matchState)
+      {
+      case LOOKING_FOR_PROMPT:
+         if (c == matchPrompt[matchPromptPos])
+         {
+            ++matchPromptPos;
+            if (matchPrompt[matchPromptPos] == '\0')
+               matchState = GATHERING_RESPONSE;
+         }
+
+         else
+         {
+            matchPromptPos = c == matchPrompt[0] ? 1 : 0;
+         }
+
+         break;
+      case GATHERING_RESPONSE: // gathering response from end of prompt to first \r
+         if (matchFields)
+         {
+            decodeField(c);
+         }
+         else if (matchResponse)
+         {
+            if (c == '\r' || matchResponseSize < 2)
+            {
+               matchState = LOOKING_FOR_TERMINATOR;
+            }
+            else
+            {
+               *matchResponse++ = c;
+               matchResponseSize--;
+            }
+         }
+         break;
+      }
+   }
+
+   // Remember lines consisting of a lone digit: the numeric result of +SBDWB/+SBDWT
+   if (c == '\n')
+   {
+      if (matchLineLen == 2 && isdigit(matchLineFirst))
+         matchResultCode = matchLineFirst - '0';
+      matchLineLen = 0;
+      if (traceCount)
+         flushTrace();
+   }
+   else
+   {
+      if (matchLineLen == 0)
+         matchLineFirst = c;
+      if (matchLineLen < 255)
+         ++matchLineLen;
+   }
+
+   // The terminator and final results are whole lines, so each match has to begin right
+   // after a CR or LF; "OK\r\n" at the end of some other line doesn't count
+   bool lineStart = matchAtLineStart;
+   matchAtLineStart = c == '\r' || c == '\n';
+
+   if (c == matchTerminator[matchTerminatorPos] && (matchTerminatorPos > 0 || lineStart))
+   {
+      ++matchTerminatorPos;
+      if (matchTerminator[matchTerminatorPos] == '\0')
+         return MATCH_TERMINATOR;
+   }
+   else
+   {
+      matchTerminatorPos = c == matchTerminator[0] && lineStart ? 1 : 0;
+   }
+
+   for (int i=0; i<2; ++i)
+   {
+      PGM_P result = finalResults[i];
+      if (c == (char)pgm_read_byte(result + matchFinalPos[i]) && (matchFinalPos[i] > 0 || lineStart))
+      {
+         ++matchFinalPos[i];
+         if (pgm_read_byte(result + matchFinalPos[i]) == '\0')
+         {
+            diagprint(F("Unexpected final result "));
+            diagprint(reinterpret_cast<FlashString>(result));
+            trace(ISBD_TRACE_WARNING, ISBD_EVENT_FINAL_RESULT, i);
+            return i == 0 ? MATCH_OK : MATCH_ERROR;
+         }
+      }
+      else
+      {
+         matchFinalPos[i] = c == result[0] && lineStart ? 1 : 0;
+      }
+   }
+   return MATCH_PENDING;
+}
+
+// Non-blocking wait: consume whatever has arrived and report ISBD_BUSY, ISBD_SUCCESS
+// (terminator seen) or ISBD_PROTOCOL_ERROR (other final result or atTimeout expired)
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::pollATResponse()
+{
+   while (filteredavailable() > 0)
+   {
+      int match = matchATResponse(filteredread());
+      if (match != MATCH_PENDING && sessionState != SESSION_WAIT_SBDRB_ECHO) // +SBDRB is timed to its last byte
+         stopCommandTimer(true);
+      if (match != MATCH_PENDING)
+         return endATResponse(match == MATCH_TERMINATOR) ? ISBD_SUCCESS : ISBD_PROTOCOL_ERROR;
+   }
+
+   if (millis() - stateStart < 1000UL * atTimeout)
+      return ISBD_BUSY;
+   stopCommandTimer(false);
+   endATResponse(false);
+   return ISBD_PROTOCOL_ERROR;
+}
+
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::cancelled()
+{
+   // Empty the serial port on either side of the client callback, which may take a while
+   drainSerial();
+   checkRingPin();
+   bool ret = callbackHook ? !callbackHook(callbackContext) : !ISBDCallback();
+   drainSerial();
+   return ret;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::checkRingPin()
+{
+   if (Policy::ringAlerts && ringPin != -1 && digitalRead(ringPin) == LOW) // Active low per guide
+      ringAsserted = true;
+}
+
+// Remember a valid -MSSTM reading and the local time it arrived.  Consecutive readings
+// far enough apart also refine the estimate of how fast millis() runs against Iridium time.
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::recordSystemTime(uint32_t ticks)
+{
+   unsigned long now = millis();
+
+   if (msstmCacheValid)
+   {
+      unsigned long elapsed = now - msstmCacheMillis;
+      if (elapsed < 1000UL * ISBD_MSSTM_DRIFT_MIN_TIME)
+         return; // too soon to learn anything; keep the older anchor
+
+      // Over a long enough gap the modem may have lost and regained system time, so the
+      // reading only re-anchors the cache; likewise if it disagrees with the prediction by
+      // more than any real clock could drift
+      unsigned long seconds = elapsed / 1000UL;
+      long errorTicks = (long)(ticks - (msstmCacheTicks + systemTicksSince(elapsed)));
+      long limitTicks = driftMs(seconds, 2 * ISBD_MSSTM_MAX_DRIFT_PPM) / 90L + 1;
+      if (seconds <= ISBD_MSSTM_DRIFT_MAX_TIME && errorTicks <= limitTicks && errorTicks >= -limitTicks)
+      {
+         // errorMs * 1000 / seconds, in pieces that fit in 32 bits
+         long errorMs = 90L * errorTicks;
+         long residual = errorMs / (long)seconds * 1000L + errorMs % (long)seconds * 1000L / (long)seconds;
+         msstmDriftPPM += residual / 2; // smooth out the 90 ms quantization of each reading
+         if (msstmDriftPPM > ISBD_MSSTM_MAX_DRIFT_PPM)
+            msstmDriftPPM = ISBD_MSSTM_MAX_DRIFT_PPM;
+         else if (msstmDriftPPM < -ISBD_MSSTM_MAX_DRIFT_PPM)
+            msstmDriftPPM = -ISBD_MSSTM_MAX_DRIFT_PPM;
+         diagprint(F("Local clock drift (ppm): "));
+         diagprint((uint16_t)(msstmDriftPPM < 0 ? -msstmDriftPPM : msstmDriftPPM));
+         diagprint(msstmDriftPPM < 0 ? F(" slow\r\n") : F(" fast\r\n"));
+         trace(ISBD_TRACE_DEBUG, ISBD_EVENT_CLOCK_DRIFT, msstmDriftPPM);
+      }
+   }
+
+   msstmCacheTicks = ticks;
+   msstmCacheMillis = now;
+   msstmCacheValid = true;
+}
+
+template <class StreamT, class Policy>
+bool BasicIridiumSBD<StreamT, Policy>::systemTimeFresh()
+{
+   return msstmCacheValid && millis() - msstmCacheMillis < 1000UL * ISBD_MSSTM_CACHE_TIME;
+}
+
+// Iridium milliseconds expected to pass in elapsedMs of local time, corrected for drift
+template <class StreamT, class Policy>
+uint32_t BasicIridiumSBD<StreamT, Policy>::driftCorrected(unsigned long elapsedMs)
+{
+   long correction = driftMs(elapsedMs / 1000UL, msstmDriftPPM);
+   return correction < 0 ? elapsedMs - (unsigned long)-correction : elapsedMs + (unsigned long)correction;
+}
+
+// Milliseconds gained in seconds at ppm, without overflowing a 32-bit long for any
+// seconds a 32-bit millis() can span
+template <class StreamT, class Policy>
+long BasicIridiumSBD<StreamT, Policy>::driftMs(unsigned long seconds, long ppm)
+{
+   return (long)(seconds / 1000UL) * ppm + (long)(seconds % 1000UL) * ppm / 1000L;
+}
+
+// Iridium ticks (90 ms) expected to pass in elapsedMs of local time
+template <class StreamT, class Policy>
+uint32_t BasicIridiumSBD<StreamT, Policy>::systemTicksSince(unsigned long elapsedMs)
+{
+   return driftCorrected(elapsedMs) / 90UL;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::power(bool on)
+{
+   if (metering() && on == this->asleep)
+   {
+      if (on)
+         awakeSince = millis();
+      else
+         bump(metrics->awakeTime, millis() - awakeSince);
+   }
+   this->asleep = !on;
+   trace(ISBD_TRACE_INFO, ISBD_EVENT_POWER, on);
+   if (!on)
+      this->msstmCacheValid = false; // the modem must reacquire system time after power-up
+
+   if (this->sleepPin == -1)
+      return;
+
+   pinMode(this->sleepPin, OUTPUT);
+
+   if (on)
+   {
+      diagprint(F("Powering on modem...\r\n"));
+      digitalWrite(this->sleepPin, HIGH); // HIGH = awake
+      lastPowerOnTime = millis();
+   }
+
+   else
+   {
+      // Best Practices Guide suggests waiting at least 2 seconds
+      // before powering off again
+      unsigned long elapsed = millis() - lastPowerOnTime;
+      if (elapsed < 2000UL)
+         delay(2000UL - elapsed);
+
+      diagprint(F("Powering off modem...\r\n"));
+      digitalWrite(this->sleepPin, LOW); // LOW = asleep
+
+      // The modem powers up at its default rate, so take the host port back there too
+      if (this->baudRate != ISBD_DEFAULT_BAUD_RATE && this->baudRateHook)
+      {
+         this->baudRateHook(this->baudRateContext, ISBD_DEFAULT_BAUD_RATE);
+         this->baudRate = ISBD_DEFAULT_BAUD_RATE;
+      }
+   }
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::send(FlashString str, bool beginLine, bool endLine)
+{
+   if (beginLine)
+      consoleprint(F(">> "));
+   consoleprint(str);
+   if (endLine)
+      consoleprint(F("\r\n"));
+   Port::print(stream, str);
+   if (metering())
+   {
+      if (beginLine)
+         startCommandTimer(reinterpret_cast<const char *>(str), true);
+      bump(metrics->bytesOut, strlen_P(reinterpret_cast<PGM_P>(str)));
+   }
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::send(const char *str)
+{
+   consoleprint(F(">> "));
+   consoleprint(str);
+   consoleprint(F("\r\n"));
+   Port::print(stream, str);
+   if (metering())
+   {
+      startCommandTimer(str, false);
+      bump(metrics->bytesOut, strlen(str));
+   }
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::send(uint16_t n)
+{
+   char digits[6];
+   const char *str = formatNumber(digits, n);
+   consoleprint(str);
+   Port::print(stream, str);
+   if (metering())
+      bump(metrics->bytesOut, strlen(str));
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::diagprint(FlashString str)
+{
+   if (!Policy::diagnostics)
+      return;
+
+   PGM_P p = reinterpret_cast<PGM_P>(str);
+   while (1)
+   {
+      char c = pgm_read_byte(p++);
+      if (c == 0) break;
+      diagsOutput(c);
+   }
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::diagprint(const char *str)
+{
+   if (!Policy::diagnostics)
+      return;
+
+   while (*str)
+      diagsOutput(*str++);
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::diagprint(uint16_t n)
+{
+   if (!Policy::diagnostics)
+      return;
+
+   char str[6];
+   diagprint(formatNumber(str, n));
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::consoleprint(FlashString str)
+{
+   if (!Policy::console)
+      return;
+
+   PGM_P p = reinterpret_cast<PGM_P>(str);
+   while (1) 
+   {
+      char c = pgm_read_byte(p++);
+      if (c == 0) break;
+      consoleOutput(c);
+   }
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::consoleprint(const char *str)
+{
+   if (!Policy::console)
+      return;
+
+   while (*str)
+      consoleOutput(*str++);
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::consoleprint(uint16_t n)
+{
+   if (!Policy::console)
+      return;
+
+   char str[6];
+   consoleprint(formatNumber(str, n));
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::consoleprint(char c)
+{
+   if (!Policy::console)
+      return;
+
+   consoleOutput(c);
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::queueTrace(uint8_t level, uint8_t event, long a0, long a1, long a2, long a3)
+{
+   ISBDTraceRecord r;
+   r.timestamp = millis();
+   r.level = level;
+   r.event = event;
+   r.args[0] = a0;
+   r.args[1] = a1;
+   r.args[2] = a2;
+   r.args[3] = a3;
+
+   // Outside a response line, or with nowhere to hold it, there's no reason to wait
+   if (Policy::traceQueueSize == 0 || matchLineLen == 0)
+   {
+      flushTrace();
+      traceSink(traceContext, r);
+      return;
+   }
+
+   if (traceCount == Policy::traceQueueSize)
+      flushTrace();
+   *traceQueue.at(traceCount++) = r;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::flushTrace()
+{
+   for (uint8_t i=0; i<traceCount; ++i)
+      if (traceSink)
+         traceSink(traceContext, *traceQueue.at(i));
+   traceCount = 0;
+}
+
+// Decimal text of n at the end of str, which must hold 6 chars; cheaper than sprintf
+template <class StreamT, class Policy>
+const char *BasicIridiumSBD<StreamT, Policy>::formatNumber(char *str, uint16_t n)
+{
+   char *p = str + 5;
+   *p = 0;
+   do
+   {
+      *--p = '0' + n % 10;
+      n /= 10;
+   } while (n);
+   return p;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::SBDRINGSeen()
+{
+   if (!Policy::ringAlerts)
+      return;
+
+   ringAsserted = true;
+   diagprint(F("SBDRING alert seen!\r\n"));
+   trace(ISBD_TRACE_INFO, ISBD_EVENT_RING, 1);
+}
+
+// Move whatever the serial port holds into the receive ring
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::drainSerial()
+{
+   while (rxCount < ISBD_RX_BUFFER_SIZE && Port::available(stream) > 0)
+   {
+      rxRing[rxHead] = Port::read(stream);
+      rxHead = (rxHead + 1) % ISBD_RX_BUFFER_SIZE;
+      ++rxCount;
+      if (metering())
+         bump(metrics->bytesIn);
+   }
+
+   // A backlog lasts until the port is emptied into the ring, and counts once however many
+   // times it is seen
+   bool backlog = rxCount == ISBD_RX_BUFFER_SIZE && Port::available(stream) > 0;
+   if (backlog && !rxBacklogged)
+   {
+      ++rxOverruns;
+      trace(ISBD_TRACE_WARNING, ISBD_EVENT_RX_OVERRUN, (long)rxOverruns);
+   }
+   rxBacklogged = backlog;
+}
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::rxAvailable()
+{
+   drainSerial();
+   return rxCount;
+}
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::rxRead()
+{
+   drainSerial();
+   if (rxCount == 0)
+      return -1;
+
+   uint8_t c = rxRing[(rxHead + ISBD_RX_BUFFER_SIZE - rxCount) % ISBD_RX_BUFFER_SIZE];
+   --rxCount;
+   return c;
+}
+
+// Point at the oldest unread bytes; returns how many are contiguous in the ring
+template <class StreamT, class Policy>
+size_t BasicIridiumSBD<StreamT, Policy>::rxContiguous(const uint8_t *&data)
+{
+   uint16_t tail = (rxHead + ISBD_RX_BUFFER_SIZE - rxCount) % ISBD_RX_BUFFER_SIZE;
+   data = rxRing + tail;
+   return rxCount < ISBD_RX_BUFFER_SIZE - tail ? rxCount : ISBD_RX_BUFFER_SIZE - tail;
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::rxConsume(size_t n)
+{
+   rxCount -= n;
+}
+
+template <class StreamT, class Policy>
+const char BasicIridiumSBD<StreamT, Policy>::unsolicited[URC_COUNT][8] PROGMEM = { "SBDRING", "+CIEV:", "+AREG:" };
+
+// Read characters until at least one can be released to the caller or the stream runs dry.
+// No timing is involved: a held prefix is resolved by the next character that arrives.
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::filterUnsolicited()
+{
+   while ((urcHeld || urcOut == urcLen) && rxAvailable() > 0)
+   {
+      char c = rxRead();
+      consoleprint(c);
+
+      if (!urcHeld)
+      {
+         urcLen = urcOut = 0;
+         if (!urcLineStart)
+         {
+            // Mid-line characters go straight through
+            urcLine[urcLen++] = c;
+            urcLineStart = c == '\r' || c == '\n';
+            continue;
+         }
+      }
+
+      if (urcMatched != -1)
+      {
+         // Collecting the parameters of a recognized code up to the end of its line
+         if (c == '\n')
+         {
+            urcLine[urcLen] = 0;
+            unsolicitedSeen(urcMatched, urcLine + strlen_P(unsolicited[urcMatched]));
+            urcLen = urcOut = 0;
+            urcHeld = false;
+            urcMatched = -1;
+            urcLineStart = true;
+         }
+         else if (c != '\r' && urcLen < sizeof(urcLine) - 1)
+         {
+            urcLine[urcLen++] = c;
+         }
+         continue;
+      }
+
+      urcLine[urcLen++] = c;
+      urcHeld = false;
+      for (int i=0; i<URC_COUNT; ++i)
+      {
+         size_t len = strlen_P(unsolicited[i]);
+         if (urcLen <= len && memcmp_P(urcLine, unsolicited[i], urcLen) == 0)
+         {
+            urcHeld = true;
+            if (urcLen == len)
+               urcMatched = i;
+            break;
+         }
+      }
+
+      // Not an unsolicited code after all: everything held so far is released
+      if (!urcHeld)
+         urcLineStart = c == '\r' || c == '\n';
+   }
+}
+
+template <class StreamT, class Policy>
+void BasicIridiumSBD<StreamT, Policy>::unsolicitedSeen(int code, const char *params)
+{
+   switch (code)
+   {
+   case URC_SBDRING:
+      SBDRINGSeen();
+      break;
+
+   case URC_CIEV: // +CIEV:<indicator>,<value> where 0 = signal strength (0-5), 1 = service available (0/1)
+   {
+      while (*params == ' ')
+         ++params;
+      const char *comma = strchr(params, ',');
+      if (comma && isdigit(params[0]) && isdigit(comma[1]))
+      {
+         if (params[0] == '0')
+            signalIndication = comma[1] - '0';
+         else if (params[0] == '1')
+            serviceIndication = comma[1] - '0';
+         trace(ISBD_TRACE_DEBUG, ISBD_EVENT_INDICATION, params[0] - '0', comma[1] - '0');
+      }
+      diagprint(reinterpret_cast<FlashString>(unsolicited[code]));
+      diagprint(params);
+      diagprint(F("\r\n"));
+      break;
+   }
+
+   default:
+      diagprint(reinterpret_cast<FlashString>(unsolicited[code]));
+      diagprint(params);
+      diagprint(F("\r\n"));
+      break;
+   }
+}
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::filteredavailable()
+{
+   filterUnsolicited();
+   return urcHeld ? 0 : urcLen - urcOut;
+}
+
+template <class StreamT, class Policy>
+int BasicIridiumSBD<StreamT, Policy>::filteredread()
+{
+   filterUnsolicited();
+
+   if (!urcHeld && urcOut < urcLen)
+      return urcLine[urcOut++];
+
+   return -1;
+}
+
+#endif